@@ -0,0 +1,348 @@
+#include "file_cache.h"
+#include "../log/log.h"
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+//监听的事件：文件内容、属性(权限)变化，文件或子目录的创建、删除、移动，目录自身被删除或移动
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+//含有//、/./、/../的路径与inotify给出的路径对不上，不进入缓存
+static bool clean_path(const char *path)
+{
+    for (const char *p = strchr(path, '/'); p; p = strchr(p + 1, '/'))
+    {
+        if (p[1] == '/')
+            return false;
+        if (p[1] == '.' && (p[2] == '/' || p[2] == '\0' || (p[2] == '.' && (p[3] == '/' || p[3] == '\0'))))
+            return false;
+    }
+    return true;
+}
+
+file_cache::file_cache()
+    : m_shard_cap(0), m_map_max(0), m_hits(0), m_misses(0), m_inotify_fd(-1), m_stop_fd(-1), m_running(false)
+{
+    for (int i = 0; i < SHARDS; ++i)
+        m_shards[i].gen = 0;
+}
+
+file_cache::~file_cache()
+{
+    shutdown();
+}
+
+bool file_cache::init(const char *root, int capacity, off_t map_max)
+{
+    m_root = root;
+    while (m_root.size() > 1 && m_root[m_root.size() - 1] == '/')
+        m_root.erase(m_root.size() - 1);
+    m_map_max = map_max;
+    if (capacity <= 0)
+        return true;
+
+    m_inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    m_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_inotify_fd < 0 || m_stop_fd < 0)
+    {
+        LOG_ERROR("file cache disabled, inotify init failed: %s", strerror(errno));
+        shutdown();
+        return false;
+    }
+    watch_dir(m_root);
+    if (m_dirs.empty())
+    {
+        LOG_ERROR("file cache disabled, cannot watch %s", m_root.c_str());
+        shutdown();
+        return false;
+    }
+
+    //没有inotify线程时不缓存，否则文件变化后会一直返回旧的内容
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+    {
+        shutdown();
+        return false;
+    }
+    m_running = true;
+    __atomic_store_n(&m_shard_cap, (capacity + SHARDS - 1) / SHARDS, __ATOMIC_RELEASE);
+    return true;
+}
+
+file_entry *file_cache::load(const char *path)
+{
+    file_entry *entry = new file_entry;
+    entry->refs = 1;
+    entry->err = 0;
+    entry->fd = -1;
+    entry->addr = NULL;
+    entry->cached = false;
+    memset(entry->response, 0, sizeof(entry->response));
+    entry->gzip = NULL;
+    if (stat(path, &entry->st) < 0)
+    {
+        entry->err = errno;
+        return entry;
+    }
+    const struct stat &st = entry->st;
+    snprintf(entry->etag, sizeof(entry->etag), "%lx-%lx-%llx", (unsigned long)st.st_ino, (unsigned long)st.st_size,
+             (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    //只打开可读的非空普通文件，目录和没有权限的文件由调用者按stat的结果处理
+    if (!S_ISREG(entry->st.st_mode) || !(entry->st.st_mode & S_IROTH) || entry->st.st_size == 0)
+        return entry;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        entry->err = errno;
+        return entry;
+    }
+    if (entry->st.st_size >= m_map_max)
+    {
+        entry->fd = fd;
+        return entry;
+    }
+    void *addr = mmap(NULL, entry->st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        entry->err = errno;
+    else
+        entry->addr = (char *)addr;
+    return entry;
+}
+
+file_entry *file_cache::acquire(const char *path)
+{
+    if (__atomic_load_n(&m_shard_cap, __ATOMIC_RELAXED) == 0 || !clean_path(path))
+    {
+        __atomic_fetch_add(&m_misses, 1, __ATOMIC_RELAXED);
+        return load(path);
+    }
+
+    std::string key(path);
+    shard &s = m_shards[std::hash<std::string>()(key) & (SHARDS - 1)];
+    s.lock.lock();
+    std::unordered_map<std::string, file_entry *>::iterator it = s.map.find(key);
+    if (it != s.map.end())
+    {
+        file_entry *entry = it->second;
+        __atomic_fetch_add(&entry->refs, 1, __ATOMIC_RELAXED);
+        s.lock.unlock();
+        __atomic_fetch_add(&m_hits, 1, __ATOMIC_RELAXED);
+        return entry;
+    }
+    unsigned gen = s.gen;
+    s.lock.unlock();
+
+    //不在锁内打开文件；两个线程同时未命中时后插入的一方使用已有的条目
+    __atomic_fetch_add(&m_misses, 1, __ATOMIC_RELAXED);
+    file_entry *entry = load(path);
+    file_entry *evicted = NULL;
+    s.lock.lock();
+    it = s.map.find(key);
+    if (s.gen != gen)
+    {
+        //打开期间有文件发生变化，本次使用新打开的条目，不放入缓存
+        s.lock.unlock();
+        return entry;
+    }
+    if (it != s.map.end())
+    {
+        evicted = entry;
+        entry = it->second;
+    }
+    else
+    {
+        //分片已满时淘汰任意一个条目
+        if ((int)s.map.size() >= m_shard_cap)
+        {
+            evicted = s.map.begin()->second;
+            s.map.erase(s.map.begin());
+        }
+        //缓存持有一个引用
+        entry->cached = true;
+        s.map[key] = entry;
+    }
+    __atomic_fetch_add(&entry->refs, 1, __ATOMIC_RELAXED);
+    s.lock.unlock();
+    if (evicted)
+        release(evicted);
+    return entry;
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    if (entry->fd >= 0)
+        close(entry->fd);
+    if (entry->addr)
+        munmap(entry->addr, entry->st.st_size);
+    for (int i = 0; i < ENC_COUNT; ++i)
+    {
+        free(entry->response[i][0]);
+        free(entry->response[i][1]);
+    }
+    free(entry->gzip);
+    delete entry;
+}
+
+void file_cache::invalidate(const std::string &path)
+{
+    shard &s = m_shards[std::hash<std::string>()(path) & (SHARDS - 1)];
+    file_entry *entry = NULL;
+    s.lock.lock();
+    ++s.gen;
+    std::unordered_map<std::string, file_entry *>::iterator it = s.map.find(path);
+    if (it != s.map.end())
+    {
+        entry = it->second;
+        s.map.erase(it);
+    }
+    s.lock.unlock();
+    if (entry)
+        release(entry);
+}
+
+void file_cache::clear()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        std::unordered_map<std::string, file_entry *> map;
+        m_shards[i].lock.lock();
+        ++m_shards[i].gen;
+        map.swap(m_shards[i].map);
+        m_shards[i].lock.unlock();
+        for (std::unordered_map<std::string, file_entry *>::iterator it = map.begin(); it != map.end(); ++it)
+            release(it->second);
+    }
+}
+
+void file_cache::watch_dir(const std::string &dir)
+{
+    int wd = inotify_add_watch(m_inotify_fd, dir.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+        LOG_ERROR("inotify_add_watch %s failed: %s", dir.c_str(), strerror(errno));
+        return;
+    }
+    m_dirs[wd] = dir;
+
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        std::string sub = dir + "/" + ent->d_name;
+        //部分文件系统不提供d_type
+        struct stat st;
+        if (ent->d_type == DT_DIR || (ent->d_type == DT_UNKNOWN && lstat(sub.c_str(), &st) == 0 && S_ISDIR(st.st_mode)))
+            watch_dir(sub);
+    }
+    closedir(d);
+}
+
+void *file_cache::worker(void *arg)
+{
+    ((file_cache *)arg)->run();
+    return NULL;
+}
+
+void file_cache::run()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2];
+    fds[0].fd = m_inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_stop_fd;
+    fds[1].events = POLLIN;
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+
+        int len = read(m_inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+            continue;
+        for (char *p = buf; p < buf + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            //事件队列溢出，丢失了变化，清空全部条目
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                clear();
+                continue;
+            }
+            std::unordered_map<int, std::string>::iterator it = m_dirs.find(ev->wd);
+            if (it == m_dirs.end())
+                continue;
+            if (ev->mask & IN_IGNORED)
+            {
+                m_dirs.erase(it);
+                continue;
+            }
+            //目录的变化影响其下所有路径(包括缓存的不存在的路径)，清空全部条目；新目录加入监听
+            if (ev->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF))
+            {
+                if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+                    watch_dir(it->second + "/" + ev->name);
+                clear();
+                continue;
+            }
+            if (ev->len > 0)
+                invalidate(it->second + "/" + ev->name);
+        }
+    }
+}
+
+void file_cache::shutdown()
+{
+    if (m_running)
+    {
+        unsigned long long one = 1;
+        ::write(m_stop_fd, &one, sizeof(one));
+        pthread_join(m_tid, NULL);
+        m_running = false;
+    }
+    __atomic_store_n(&m_shard_cap, 0, __ATOMIC_RELEASE);
+    clear();
+    if (m_inotify_fd >= 0)
+    {
+        close(m_inotify_fd);
+        m_inotify_fd = -1;
+    }
+    if (m_stop_fd >= 0)
+    {
+        close(m_stop_fd);
+        m_stop_fd = -1;
+    }
+    m_dirs.clear();
+}
+
+void file_cache::get_stats(long long &hits, long long &misses) const
+{
+    hits = __atomic_load_n(&m_hits, __ATOMIC_RELAXED);
+    misses = __atomic_load_n(&m_misses, __ATOMIC_RELAXED);
+}
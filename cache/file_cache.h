@@ -0,0 +1,111 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+//附加在条目上的一块内存(预先生成的响应、压缩后的内容)，len为data的长度
+struct file_buf
+{
+    int len;
+    char data[1];
+};
+
+//响应的内容编码，file_entry::response的第一维
+enum CONTENT_ENCODING
+{
+    ENC_IDENTITY = 0,
+    ENC_GZIP,
+    ENC_BR,
+    ENC_COUNT
+};
+
+//缓存的文件，按引用计数共享：缓存自身持有一个引用，每个正在发送它的连接各持有一个
+//最后一个引用释放时关闭文件、解除映射，因此文件被修改后旧的条目仍可安全地发送完
+struct file_entry
+{
+    int refs;
+    // stat或open失败时的errno，非0表示路径不存在等(负缓存)，其余字段无效
+    int err;
+    struct stat st;
+    //缓存验证器，打开时按stat生成一次：由inode、大小和修改时间(纳秒)组成的强ETag(不含引号)，以及HTTP日期格式的修改时间
+    char etag[64];
+    char last_modified[32];
+    //用sendfile发送的大文件的描述符，-1为没有
+    int fd;
+    //小文件的只读共享映射，NULL为没有
+    char *addr;
+    //条目已放入缓存，之后的请求会复用它
+    bool cached;
+    //由使用者在第一次发送时生成的完整响应，按内容编码和是否长连接(1为长连接)区分，NULL为尚未生成
+    file_buf *response[ENC_COUNT][2];
+    //即时压缩的gzip内容，NULL为尚未压缩，len为0表示压缩后没有变小
+    //以上两项用原子操作读写，释放条目时free
+    file_buf *gzip;
+};
+
+//静态文件的打开文件和元数据缓存：按路径分片的哈希表，每个分片一把锁
+//命中时不做任何文件系统调用；不存在的路径同样缓存；inotify监听网站根目录(含子目录)，文件变化时使对应条目失效
+class file_cache
+{
+public:
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    // root为网站根目录，capacity为最多缓存的条目数，0为不缓存(每次都重新打开)
+    //小于map_max的文件mmap后关闭描述符，其余保留描述符用于sendfile
+    bool init(const char *root, int capacity, off_t map_max);
+    //取得路径对应的条目，引用计数加一，不会返回NULL；用完后调用release
+    file_entry *acquire(const char *path);
+    void release(file_entry *entry);
+    //停止inotify线程并清空缓存，正在使用的条目在release时释放
+    void shutdown();
+
+    //命中和未命中次数
+    void get_stats(long long &hits, long long &misses) const;
+
+private:
+    file_cache();
+    ~file_cache();
+
+    //分片个数，2的幂
+    static const int SHARDS = 16;
+
+    struct shard
+    {
+        locker lock;
+        std::unordered_map<std::string, file_entry *> map;
+        //失效的次数，未命中时打开文件期间有条目失效则不插入，避免缓存变化之前的内容
+        unsigned gen;
+    };
+
+    //打开文件并建立条目，引用计数为1
+    file_entry *load(const char *path);
+    void invalidate(const std::string &path);
+    void clear();
+    //递归监听目录及其子目录
+    void watch_dir(const std::string &dir);
+    static void *worker(void *arg);
+    void run();
+
+private:
+    std::string m_root;
+    int m_shard_cap;
+    off_t m_map_max;
+    shard m_shards[SHARDS];
+    long long m_hits;
+    long long m_misses;
+
+    int m_inotify_fd;
+    //通知inotify线程退出
+    int m_stop_fd;
+    pthread_t m_tid;
+    bool m_running;
+    // inotify监听描述符到目录路径的映射，只由inotify线程访问
+    std::unordered_map<int, std::string> m_dirs;
+};
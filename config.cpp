@@ -0,0 +1,198 @@
+#include "config.h"
+#include <stdio.h>
+#include <sched.h>
+
+Config::Config()
+{
+    //端口号,默认8001
+    PORT = 8001;
+
+    //反应堆个数,默认单反应堆
+    REACTOR_NUM = 1;
+
+    // I/O后端,默认epoll
+    IO_URING = 0;
+
+    //时间轮刻度,默认1000毫秒
+    TIMER_MS = 1000;
+
+    //线程池调度方式,默认共享队列
+    WORK_STEALING = 0;
+
+    //线程数,默认按CPU核数设置
+    THREAD_MIN = 0;
+    THREAD_MAX = 0;
+
+    //数据库请求最多占一半工作线程
+    DB_PCT = 50;
+
+    //排空期限,默认5秒
+    DRAIN_MS = 5000;
+
+    //长连接空闲5秒关闭,每个连接最多1000个请求
+    KEEPALIVE_MS = 5000;
+    MAX_REQUESTS = 1000;
+
+    //静态文件缓存1024个条目
+    FILE_CACHE = 1024;
+    CACHE_POLICY = NULL;
+
+    //默认不绑定CPU
+    LOG_CPU = -1;
+}
+
+bool Config::parse_cpu_list(const char *str, std::vector<int> &cpus)
+{
+    cpus.clear();
+    while (*str)
+    {
+        char *end;
+        long first = strtol(str, &end, 10);
+        if (end == str)
+            return false;
+        long last = first;
+        if (*end == '-')
+        {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str)
+                return false;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back((int)cpu);
+
+        if (*end == ',')
+            ++end;
+        else if (*end != '\0')
+            return false;
+        str = end;
+    }
+    return !cpus.empty();
+}
+
+void Config::parse_arg(int argc, char *argv[])
+{
+    int opt;
+    const char *str = "p:r:u:t:w:n:m:d:s:k:K:c:C:A:W:L:";
+    while ((opt = getopt(argc, argv, str)) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+        {
+            PORT = atoi(optarg);
+            break;
+        }
+        case 'r':
+        {
+            REACTOR_NUM = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            IO_URING = atoi(optarg);
+            break;
+        }
+        case 't':
+        {
+            TIMER_MS = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            WORK_STEALING = atoi(optarg);
+            break;
+        }
+        case 'n':
+        {
+            THREAD_MIN = atoi(optarg);
+            break;
+        }
+        case 'm':
+        {
+            THREAD_MAX = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            DB_PCT = atoi(optarg);
+            break;
+        }
+        case 's':
+        {
+            DRAIN_MS = atoi(optarg);
+            break;
+        }
+        case 'k':
+        {
+            KEEPALIVE_MS = atoi(optarg);
+            break;
+        }
+        case 'K':
+        {
+            MAX_REQUESTS = atoi(optarg);
+            break;
+        }
+        case 'c':
+        {
+            FILE_CACHE = atoi(optarg);
+            break;
+        }
+        case 'C':
+        {
+            CACHE_POLICY = optarg;
+            break;
+        }
+        case 'A':
+        {
+            if (!parse_cpu_list(optarg, REACTOR_CPUS))
+                fprintf(stderr, "invalid cpu list: %s\n", optarg);
+            break;
+        }
+        case 'W':
+        {
+            if (!parse_cpu_list(optarg, WORKER_CPUS))
+                fprintf(stderr, "invalid cpu list: %s\n", optarg);
+            break;
+        }
+        case 'L':
+        {
+            LOG_CPU = atoi(optarg);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    if (TIMER_MS <= 0)
+        TIMER_MS = 1000;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores <= 0)
+        cores = 1;
+
+    //按CPU核数设置反应堆个数
+    if (REACTOR_NUM <= 0)
+        REACTOR_NUM = (int)cores;
+
+    //按CPU核数设置线程数
+    if (THREAD_MIN <= 0)
+        THREAD_MIN = (int)cores;
+    if (THREAD_MAX <= 0)
+        THREAD_MAX = THREAD_MIN * 4;
+    if (THREAD_MAX < THREAD_MIN)
+        THREAD_MAX = THREAD_MIN;
+    if (DB_PCT <= 0 || DB_PCT > 100)
+        DB_PCT = 50;
+    if (DRAIN_MS < 0)
+        DRAIN_MS = 5000;
+    if (KEEPALIVE_MS < 0)
+        KEEPALIVE_MS = 5000;
+    if (MAX_REQUESTS < 0)
+        MAX_REQUESTS = 1000;
+    if (FILE_CACHE < 0)
+        FILE_CACHE = 1024;
+}
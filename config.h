@@ -0,0 +1,66 @@
+#pragma once
+#include <unistd.h>
+#include <stdlib.h>
+#include <vector>
+
+//服务器运行参数，由命令行解析得到
+class Config
+{
+public:
+    Config();
+    ~Config() {}
+
+    //解析命令行参数
+    void parse_arg(int argc, char *argv[]);
+
+    //解析CPU列表，格式错误返回false
+    static bool parse_cpu_list(const char *str, std::vector<int> &cpus);
+
+public:
+    //监听端口号
+    int PORT;
+
+    //反应堆(事件循环)个数
+    // 1为单反应堆模式；大于1时每个反应堆独占epoll、SO_REUSEPORT监听socket、连接表和定时器链表
+    // 0表示按CPU核数自动设置
+    int REACTOR_NUM;
+
+    // I/O后端，0为epoll，1为io_uring(需编译时开启WITH_IO_URING，内核不支持时回退到epoll)
+    int IO_URING;
+
+    //时间轮的刻度，毫秒，决定超时连接被关闭的精度
+    int TIMER_MS;
+
+    //线程池调度方式，0为共享队列，1为工作窃取(每个工作线程一个队列，连接按sockfd固定到工作线程)
+    int WORK_STEALING;
+
+    //线程池的最小、最大线程数，最大值大于最小值时按排队时间和阻塞时间伸缩
+    //默认最小为CPU核数，最大为其4倍(处理登录请求的线程会阻塞在数据库查询上)
+    int THREAD_MIN;
+    int THREAD_MAX;
+
+    //同时处理数据库请求(登录、注册)的工作线程数占当前线程数的百分比上限，至少1个线程
+    //数据库请求在单独的低优先级队列中，静态文件请求优先
+    int DB_PCT;
+
+    //收到SIGTERM后排空的期限，毫秒：停止accept，等待已收到的请求处理完、响应发送完
+    int DRAIN_MS;
+
+    //长连接空闲(等待下一个请求)的超时，毫秒，与请求的超时(15秒)分开；0为不保持连接
+    int KEEPALIVE_MS;
+    //每个连接最多处理的请求数，达到后响应Connection: close；0为不限制
+    int MAX_REQUESTS;
+
+    //静态文件缓存最多的条目数(打开的文件、映射和stat信息，含不存在的路径)，0为不缓存
+    int FILE_CACHE;
+    //按路径前缀的缓存策略(Cache-Control)，格式见http_conn::init_cache_policy，NULL为不发送
+    const char *CACHE_POLICY;
+
+    //绑定的CPU列表，格式如"0-3,8"，为空时不绑定
+    //第i个反应堆绑定REACTOR_CPUS[i]，编号为i的工作线程绑定WORKER_CPUS[i]，都按列表长度循环
+    //反应堆的连接表分配在其CPU所在的NUMA结点上
+    std::vector<int> REACTOR_CPUS;
+    std::vector<int> WORKER_CPUS;
+    //异步写日志线程绑定的CPU，-1为不绑定
+    int LOG_CPU;
+};
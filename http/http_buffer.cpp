@@ -0,0 +1,187 @@
+#include "http_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+segment_pool::~segment_pool()
+{
+    while (m_free)
+    {
+        buffer_segment *next = m_free->next;
+        free(m_free);
+        m_free = next;
+    }
+}
+
+buffer_segment *segment_pool::get()
+{
+    m_lock.lock();
+    buffer_segment *seg = m_free;
+    if (seg)
+    {
+        m_free = seg->next;
+        --m_count;
+    }
+    m_lock.unlock();
+    if (!seg)
+    {
+        seg = (buffer_segment *)malloc(sizeof(buffer_segment));
+        if (!seg)
+            return NULL;
+    }
+    seg->next = NULL;
+    seg->len = 0;
+    return seg;
+}
+
+void segment_pool::put(buffer_segment *head)
+{
+    //超出上限的段在锁外释放
+    buffer_segment *excess = NULL;
+    m_lock.lock();
+    while (head)
+    {
+        buffer_segment *next = head->next;
+        if (m_count < MAX_FREE)
+        {
+            head->next = m_free;
+            m_free = head;
+            ++m_count;
+        }
+        else
+        {
+            head->next = excess;
+            excess = head;
+        }
+        head = next;
+    }
+    m_lock.unlock();
+    while (excess)
+    {
+        buffer_segment *next = excess->next;
+        free(excess);
+        excess = next;
+    }
+}
+
+void response_buffer::push(const char *base, size_t len)
+{
+    m_size += len;
+    if (!m_iov.empty())
+    {
+        struct iovec &last = m_iov.back();
+        if ((char *)last.iov_base + last.iov_len == base)
+        {
+            last.iov_len += len;
+            return;
+        }
+    }
+    struct iovec v;
+    v.iov_base = (void *)base;
+    v.iov_len = len;
+    m_iov.push_back(v);
+}
+
+bool response_buffer::append(const char *data, int len)
+{
+    while (len > 0)
+    {
+        if (!m_tail || m_tail->len == buffer_segment::DATA_SIZE)
+        {
+            buffer_segment *seg = segment_pool::get_instance()->get();
+            if (!seg)
+                return false;
+            if (m_tail)
+                m_tail->next = seg;
+            else
+                m_head = seg;
+            m_tail = seg;
+        }
+        int n = buffer_segment::DATA_SIZE - m_tail->len;
+        if (n > len)
+            n = len;
+        char *dst = m_tail->data + m_tail->len;
+        memcpy(dst, data, n);
+        m_tail->len += n;
+        push(dst, n);
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+void response_buffer::append_ref(const char *base, size_t len)
+{
+    if (len > 0)
+        push(base, len);
+}
+
+response_buffer::mark response_buffer::get_mark() const
+{
+    mark m;
+    m.tail = m_tail;
+    m.tail_len = m_tail ? m_tail->len : 0;
+    m.iov_count = m_iov.size();
+    m.last_len = m_iov.empty() ? 0 : m_iov.back().iov_len;
+    m.size = m_size;
+    return m;
+}
+
+void response_buffer::rollback(const mark &m)
+{
+    buffer_segment *rest;
+    if (m.tail)
+    {
+        rest = m.tail->next;
+        m.tail->next = NULL;
+        m.tail->len = m.tail_len;
+    }
+    else
+    {
+        rest = m_head;
+        m_head = NULL;
+    }
+    m_tail = m.tail;
+    segment_pool::get_instance()->put(rest);
+
+    m_iov.resize(m.iov_count);
+    if (m.iov_count > 0)
+        m_iov.back().iov_len = m.last_len;
+    m_size = m.size;
+}
+
+size_t response_buffer::copy_since(const mark &m, char *dst) const
+{
+    //m之后的数据可能接在m时最后一个iovec的后面
+    char *p = dst;
+    for (size_t i = m.iov_count > 0 ? m.iov_count - 1 : 0; i < m_iov.size(); ++i)
+    {
+        size_t skip = (m.iov_count > 0 && i == m.iov_count - 1) ? m.last_len : 0;
+        memcpy(p, (char *)m_iov[i].iov_base + skip, m_iov[i].iov_len - skip);
+        p += m_iov[i].iov_len - skip;
+    }
+    return p - dst;
+}
+
+bool response_buffer::advance(size_t len)
+{
+    while (len > 0 && m_pos < m_iov.size())
+    {
+        struct iovec &v = m_iov[m_pos];
+        size_t n = len < v.iov_len ? len : v.iov_len;
+        v.iov_base = (char *)v.iov_base + n;
+        v.iov_len -= n;
+        len -= n;
+        if (v.iov_len == 0)
+            ++m_pos;
+    }
+    return m_pos < m_iov.size();
+}
+
+void response_buffer::clear()
+{
+    segment_pool::get_instance()->put(m_head);
+    m_head = m_tail = NULL;
+    m_iov.clear();
+    m_pos = 0;
+    m_size = 0;
+}
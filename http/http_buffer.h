@@ -0,0 +1,110 @@
+#pragma once
+#include <sys/uio.h>
+#include <stddef.h>
+#include <vector>
+#include "../lock/locker.h"
+
+//响应缓冲区的一段，从segment_pool分配，所在的响应缓冲区清空时归还
+struct buffer_segment
+{
+    //每段连同头部共4KB
+    static const int DATA_SIZE = 4096 - 16;
+    buffer_segment *next;
+    //data中已写入的长度
+    int len;
+    char data[DATA_SIZE];
+};
+
+//所有连接共享的空闲段链表，一把锁；超过上限的段直接释放，避免峰值过后一直占用内存
+class segment_pool
+{
+public:
+    static segment_pool *get_instance()
+    {
+        static segment_pool instance;
+        return &instance;
+    }
+
+    //取得一个空段，内存不足返回NULL
+    buffer_segment *get();
+    //归还以head开头的一串段
+    void put(buffer_segment *head);
+
+private:
+    segment_pool() : m_free(NULL), m_count(0) {}
+    ~segment_pool();
+
+    //最多保留的空闲段数
+    static const int MAX_FREE = 1024;
+
+    locker m_lock;
+    buffer_segment *m_free;
+    int m_count;
+};
+
+//一批响应的发送缓冲区：生成的数据(状态行、消息头等)依次拷入一串段，段写满时从池中取下一段，已写入的数据不移动、不重新分配
+//文件映射、预先生成的响应等已在内存中的数据只记录位置，不拷贝；两者按追加的顺序组成iovec，直接交给writev/io_uring
+//发送时只移动指向第一个未发送完的iovec的游标，部分发送后从游标处继续
+class response_buffer
+{
+public:
+    //追加位置，用于撤销生成失败的响应
+    struct mark
+    {
+        buffer_segment *tail;
+        int tail_len;
+        size_t iov_count;
+        size_t last_len;
+        size_t size;
+    };
+
+    response_buffer() : m_head(NULL), m_tail(NULL), m_pos(0), m_size(0) {}
+    ~response_buffer()
+    {
+        clear();
+    }
+
+    //拷贝len字节，段不够时取新段；内存不足返回false
+    bool append(const char *data, int len);
+    //引用base开始的len字节，发送完之前调用者保证其有效
+    void append_ref(const char *base, size_t len);
+
+    mark get_mark() const;
+    //撤销m之后追加的全部数据，之后取得的段归还到池中
+    void rollback(const mark &m);
+    //把m之后拷入的数据(其间没有append_ref)复制到dst，返回长度
+    size_t copy_since(const mark &m, char *dst) const;
+
+    //已追加的总字节数，包括引用的数据
+    size_t size() const
+    {
+        return m_size;
+    }
+    //本批没有任何数据
+    bool empty() const
+    {
+        return m_iov.empty();
+    }
+    //取得从游标开始的iovec，count为0表示已全部发送
+    struct iovec *iov(int &count)
+    {
+        count = m_iov.size() - m_pos;
+        return count > 0 ? &m_iov[m_pos] : NULL;
+    }
+    //已发送len字节，返回是否还有数据待发送
+    bool advance(size_t len);
+    //清空并把所有段归还到池中，iovec数组保留容量供下一批使用
+    void clear();
+
+private:
+    //追加一个iovec，与上一个在内存中相连时合并
+    void push(const char *base, size_t len);
+
+private:
+    buffer_segment *m_head;
+    buffer_segment *m_tail;
+    std::vector<struct iovec> m_iov;
+    //第一个未发送完的iovec
+    size_t m_pos;
+    size_t m_size;
+};
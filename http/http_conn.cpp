@@ -1,28 +1,193 @@
 #include "./http_conn.h"
+#include "./http_scan.h"
+#include "./http_route.h"
+#include "./http_buffer.h"
 #include "../log/log.h"
+#include "../reactor/reactor.h"
 #include <map>
 #include <mysql/mysql.h>
-
-//定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
+#include <zlib.h>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+
+//预先序列化的状态行
+#define STATUS_200 "HTTP/1.1 200 OK\r\n"
+#define STATUS_206 "HTTP/1.1 206 Partial Content\r\n"
+#define STATUS_304 "HTTP/1.1 304 Not Modified\r\n"
+#define STATUS_400 "HTTP/1.1 400 Bad Request\r\n"
+#define STATUS_403 "HTTP/1.1 403 Forbidden\r\n"
+#define STATUS_404 "HTTP/1.1 404 Not Found\r\n"
+#define STATUS_416 "HTTP/1.1 416 Range Not Satisfiable\r\n"
+#define STATUS_500 "HTTP/1.1 500 Internal Error\r\n"
+
+//追加字符串字面量，长度在编译期确定
+#define add_literal(s) add_bytes(s, sizeof(s) - 1)
+
+//错误响应的消息体
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
-const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
+//完整的错误响应(状态行、消息头和消息体)，启动时生成，下标为是否长连接；发送时iovec直接指向它们，不拷贝
+static std::string error_response(const char *status, const char *form, bool linger)
+{
+    std::string res = status;
+    res += "Content-Length:" + std::to_string(strlen(form)) + "\r\n";
+    res += linger ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n";
+    return res + form;
+}
+static const std::string error_400[2] = {error_response(STATUS_400, error_400_form, false), error_response(STATUS_400, error_400_form, true)};
+static const std::string error_403[2] = {error_response(STATUS_403, error_403_form, false), error_response(STATUS_403, error_403_form, true)};
+static const std::string error_404[2] = {error_response(STATUS_404, error_404_form, false), error_response(STATUS_404, error_404_form, true)};
+static const std::string error_500[2] = {error_response(STATUS_500, error_500_form, false), error_response(STATUS_500, error_500_form, true)};
+
+//两位数字的十进制表，整数转字符串时一次处理两位
+static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                  "8081828384858687888990919293949596979899";
+
+//过载时的响应，预先生成，不经过报文解析和格式化
+static const char overload_503[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                   "Retry-After: 1\r\n"
+                                   "Content-Length: 0\r\n"
+                                   "Connection: close\r\n\r\n";
+
 //网站根目录，文件夹内存放请求的资源和跳转的html文件
 //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
 const char *doc_root = "/home/von/Desktop/MyWebServer/root";
 
+//按扩展名(不区分大小写)的Content-Type，compressible为文本类的可压缩类型
+static const struct
+{
+    const char *ext;
+    const char *type;
+    bool compressible;
+} mime_types[] = {
+    {"html", "text/html", true},
+    {"htm", "text/html", true},
+    {"css", "text/css", true},
+    {"js", "application/javascript", true},
+    {"json", "application/json", true},
+    {"txt", "text/plain", true},
+    {"xml", "text/xml", true},
+    {"svg", "image/svg+xml", true},
+    {"png", "image/png", false},
+    {"jpg", "image/jpeg", false},
+    {"jpeg", "image/jpeg", false},
+    {"gif", "image/gif", false},
+    {"webp", "image/webp", false},
+    {"ico", "image/x-icon", false},
+    {"mp4", "video/mp4", false},
+    {"gz", "application/gzip", false},
+};
+
+static const char *mime_type(const char *path, bool &compressible)
+{
+    compressible = false;
+    const char *dot = strrchr(path, '.');
+    if (dot && !strchr(dot, '/'))
+    {
+        for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); ++i)
+        {
+            if (strcasecmp(dot + 1, mime_types[i].ext) == 0)
+            {
+                compressible = mime_types[i].compressible;
+                return mime_types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+//解析Accept-Encoding，返回可接受的编码的位掩码(1 << ENC_GZIP等)
+// q=0表示不可接受，明确列出的编码优先于*；其余q值不比较大小，可接受时总是br优先
+static int accept_encoding(const char *value)
+{
+    int on = 0, off = 0;
+    int star = -1;
+    const char *p = value;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if (!*p)
+            break;
+        const char *token = p;
+        int len = strcspn(p, " \t,;");
+        p += len;
+        const char *end = p + strcspn(p, ",");
+
+        //参数中只关心q
+        bool zero = false;
+        for (const char *param = p; param < end; ++param)
+        {
+            if (*param != ';')
+                continue;
+            param += 1 + strspn(param + 1, " \t");
+            if ((*param == 'q' || *param == 'Q') && param[1] == '=')
+                zero = strtod(param + 2, NULL) == 0;
+        }
+        p = end;
+
+        int bit = 0;
+        if ((len == 4 && strncasecmp(token, "gzip", 4) == 0) || (len == 6 && strncasecmp(token, "x-gzip", 6) == 0))
+            bit = 1 << ENC_GZIP;
+        else if (len == 2 && strncasecmp(token, "br", 2) == 0)
+            bit = 1 << ENC_BR;
+        else if (len == 1 && *token == '*')
+            star = zero ? 0 : 1;
+        if (zero)
+            off |= bit;
+        else
+            on |= bit;
+    }
+    if (star == 1)
+        on |= ((1 << ENC_GZIP) | (1 << ENC_BR)) & ~off;
+    return on & ~off;
+}
+
+//按路径前缀的缓存策略，按前缀长度从长到短排列
+struct cache_policy
+{
+    std::string prefix;
+    // Cache-Control的值
+    std::string value;
+    // max-age的秒数，用于HTTP/1.0的Expires；no-cache、no-store为-1
+    int max_age;
+};
+static std::vector<cache_policy> cache_policies;
+
+//多区间响应的分隔符，固定不变；文件内容中恰好出现"\r\n--分隔符"的情况不予考虑
+static const char range_boundary[] = "3d6b6a416f9b5e8f1c20";
+
+//十进制位数，用于预先计算多区间响应的长度
+static int decimal_len(unsigned long long value)
+{
+    int len = 1;
+    while (value >= 10)
+    {
+        value /= 10;
+        ++len;
+    }
+    return len;
+}
+
+//同一文件不同编码的表示使用不同的ETag
+static const char *etag_suffix(CONTENT_ENCODING enc)
+{
+    return enc == ENC_GZIP ? "-gz" : enc == ENC_BR ? "-br" : "";
+}
+
 //创建数据库连接池
 connection_pool *connPool = connection_pool::GetInstance("localhost", "root", "1234", "myserver", 3306, 5);
 
-//将表中的用户名和密码放入map
+//将表中的用户名和密码放入map，登录和注册的工作线程并发访问，由users_lock保护
 map<string, string> users;
+static locker users_lock;
+
+//路由表，由init_routes在启动时注册
+static route_table<http_conn::route_handler> routes;
 
 void http_conn::initmysql_result()
 {
@@ -64,6 +229,60 @@ void http_conn::initmysql_result()
     }
 }
 
+void http_conn::init_file_cache(int capacity)
+{
+    file_cache::get_instance()->init(doc_root, capacity, SENDFILE_THRESHOLD);
+}
+
+void http_conn::init_routes()
+{
+    //首页，以及首页上的两个按钮跳转的注册、登录页面
+    routes.add(1 << GET | 1 << POST, "/", &http_conn::serve_file, "/judge.html");
+    routes.add(1 << GET | 1 << POST, "/0", &http_conn::serve_file, "/register.html");
+    routes.add(1 << GET | 1 << POST, "/1", &http_conn::serve_file, "/log.html");
+    //登录、注册表单，访问用户表，注册时查询数据库；CGISQL.cgi为早期页面使用的地址
+    routes.add(1 << POST, "/2check.cgi", &http_conn::serve_login, NULL, true);
+    routes.add(1 << POST, "/3check.cgi", &http_conn::serve_register, NULL, true);
+    routes.add(1 << POST, "/2CGISQL.cgi", &http_conn::serve_login, NULL, true);
+    routes.add(1 << POST, "/3CGISQL.cgi", &http_conn::serve_register, NULL, true);
+}
+
+bool http_conn::init_cache_policy(const char *spec)
+{
+    cache_policies.clear();
+    if (!spec)
+        return true;
+    const char *p = spec;
+    while (*p)
+    {
+        const char *end = p + strcspn(p, ",");
+        const char *eq = (const char *)memchr(p, '=', end - p);
+        if (!eq || *p != '/')
+            return false;
+        cache_policy policy;
+        policy.prefix.assign(p, eq - p);
+        policy.value.assign(eq + 1, end - eq - 1);
+        if (policy.value == "no-cache" || policy.value == "no-store")
+            policy.max_age = -1;
+        else
+        {
+            char *num_end;
+            long age = strtol(policy.value.c_str(), &num_end, 10);
+            if (policy.value.empty() || *num_end || age < 0 || age > 0x7fffffff)
+                return false;
+            policy.max_age = (int)age;
+            policy.value = "max-age=" + policy.value;
+        }
+        cache_policies.push_back(policy);
+        p = *end ? end + 1 : end;
+    }
+    //查找时取第一个匹配的前缀，即最长的前缀
+    std::stable_sort(cache_policies.begin(), cache_policies.end(), [](const cache_policy &a, const cache_policy &b) {
+        return a.prefix.size() > b.prefix.size();
+    });
+    return true;
+}
+
 //对文件描述符设置非阻塞
 int setnonblocking(int fd)
 {
@@ -113,32 +332,64 @@ void modfd(int epollfd, int fd, int ev)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
-
-//关闭连接，关闭一个连接，客户总量减一
+//关闭连接，连接计数由所属反应堆维护
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1))
     {
+        //连接在发送途中被关闭时，本批映射的文件和发送缓冲区还没有释放
+        unmap();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
-        m_user_count--;
     }
 }
 
-void http_conn::init(int sockfd, const sockaddr_in &addr)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, reactor *owner, int max_requests)
 {
     m_sockfd = sockfd;
+    m_max_requests = max_requests;
     m_address = addr;
-    addfd(m_epollfd, sockfd, true);
-    m_user_count++;
+    m_epollfd = epollfd;
+    m_reactor = owner;
+    //io_uring后端由反应堆直接提交收发请求，不需要注册epoll
+    if (!m_reactor)
+        addfd(m_epollfd, sockfd, true);
     init();
 }
 
+void http_conn::rearm(int ev)
+{
+    if (m_reactor)
+        m_reactor->post(this, ev);
+    else
+        modfd(m_epollfd, m_sockfd, ev);
+    //重新注册之后才交还，之前反应堆不会关闭连接，modfd不会作用到关闭后复用同一fd的新连接上
+    //此后工作线程不再访问连接
+    __atomic_sub_fetch(&m_busy, 1, __ATOMIC_RELEASE);
+}
+
 //初始化新接受的连接
-// check_state默认为分析请求行状态
 void http_conn::init()
+{
+    init_request();
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    m_req_start = 0;
+    m_out.clear();
+    m_file_count = 0;
+    m_file_address = 0;
+    m_file = NULL;
+    m_range_map = NULL;
+    m_range_map_len = 0;
+    m_send_fd = -1;
+    m_keep_alive = false;
+    m_requests = 0;
+    memset(m_read_buf, '\0', READ_BUFFER_SIZE); // char 空字符
+}
+
+// check_state默认为分析请求行状态
+void http_conn::init_request()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
@@ -146,24 +397,81 @@ void http_conn::init()
     m_url = 0; // ASCII NULL
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
+    m_body_state = BODY_DATA;
+    m_body_left = 0;
+    m_form_len = 0;
+    m_form_overflow = false;
+    m_content_type = NULL;
+    m_encoding = ENC_IDENTITY;
+    m_vary = false;
+    m_cache_headers = false;
+    m_policy = NULL;
+    m_range_count = 0;
     m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    m_string = 0;
     cgi = 0;
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE); // char 空字符
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    m_header_count = 0;
+    memset(m_known, 0, sizeof(m_known));
     memset(m_real_file, '\0', FILENAME_LEN);
 }
 
+void http_conn::finish_request()
+{
+    //没有被本批响应引用的文件(如空文件、没有权限的文件)在这里释放
+    unmap_file();
+    //消息体已在parse_content中从读缓冲区移除，下一个请求紧接在当前请求头之后
+    int end = m_checked_idx;
+    m_keep_alive = m_linger;
+    m_start_line = m_checked_idx = m_req_start = end;
+    init_request();
+}
+
+void http_conn::next_batch()
+{
+    unmap();
+
+    //已处理的请求不再需要，未处理的数据移到开头，腾出读缓冲区
+    int shift = m_req_start;
+    if (shift == 0)
+        return;
+    memmove(m_read_buf, m_read_buf + shift, m_read_idx - shift);
+    m_read_idx -= shift;
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_req_start = 0;
+
+    //下一个请求可能已经解析了一部分，指向读缓冲区的位置随之移动
+    if (m_url)
+        m_url -= shift;
+    if (m_version)
+        m_version -= shift;
+    if (m_host)
+        m_host -= shift;
+    for (int i = 0; i < m_header_count; ++i)
+    {
+        m_headers[i].name -= shift;
+        m_headers[i].value -= shift;
+    }
+    for (int i = 0; i < HDR_COUNT; ++i)
+    {
+        if (m_known[i].value)
+        {
+            m_known[i].name -= shift;
+            m_known[i].value -= shift;
+        }
+    }
+}
+
 //从状态机，用于读取一行内容
 //返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
 // m_read_idx指向缓冲区m_read_buf的数据末尾的下一个字节
+//行结束符由scan_line_end按向量宽度查找，数据不完整时m_checked_idx停在已扫描的位置，下次从这里继续
 http_conn::LINE_STATUS http_conn::parse_line()
 {
     char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    m_checked_idx = scan_line_end(m_read_buf, m_checked_idx, m_read_idx);
+    if (m_checked_idx < m_read_idx)
     {
         // temp为将要分析的字节
         temp = m_read_buf[m_checked_idx];
@@ -211,7 +519,8 @@ bool http_conn::read_once()
         return false;
     }
     int bytes_read = 0;
-    while (true)
+    //读缓冲区满时停止，其余数据留在socket中，处理完缓冲区中的请求后重新注册读事件时再读
+    while (m_read_idx < READ_BUFFER_SIZE)
     {
         //返回其实际copy的字节数；数组指针+偏移
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
@@ -233,12 +542,26 @@ bool http_conn::read_once()
     return true;
 }
 
+bool http_conn::read_append(const char *data, int len)
+{
+    if (m_read_idx + len > READ_BUFFER_SIZE)
+    {
+        return false;
+    }
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    return true;
+}
+
 //解析http请求行，获得请求方法，目标url及http版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 {
+    //请求行的\r\n已被parse_line改为\0\0，m_checked_idx指向其后，行尾不必再用strlen查找
+    char *end = m_read_buf + m_checked_idx - 2;
+
     //在HTTP报文中，请求行用来说明请求类型,要访问的资源以及所使用的HTTP版本，其中各个部分之间通过\t或空格分隔。
     //请求行中最先含有空格或\t任一字符的位置并返回
-    m_url = strpbrk(text, " \t");
+    m_url = scan_token_end(text, end);
 
     //如果没有空格或\t，则报文格式有误
     if (!m_url)
@@ -263,17 +586,21 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 
     // m_url此时跳过了第一个空格或\t字符，但不知道之后是否还有
     //将m_url向后偏移，通过查找，继续跳过空格和\t字符，指向请求资源的第一个字符
-    m_url += strspn(m_url, " \t");
+    m_url = skip_blank(m_url, end);
 
     //使用与判断请求方式的相同逻辑，判断HTTP版本号
-    m_version = strpbrk(m_url, " \t");
+    m_version = scan_token_end(m_url, end);
     if (!m_version)
         return BAD_REQUEST;
     *m_version++ = '\0';
-    m_version += strspn(m_version, " \t");
+    m_version = skip_blank(m_version, end);
 
-    //仅支持HTTP/1.1
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    //支持HTTP/1.1和HTTP/1.0，前者默认为长连接，后者默认为短连接，之后由Connection头部决定
+    if (strcasecmp(m_version, "HTTP/1.1") == 0)
+        m_linger = true;
+    else if (strcasecmp(m_version, "HTTP/1.0") == 0)
+        m_linger = false;
+    else
         return BAD_REQUEST;
 
     //对请求资源前7个字符进行判断
@@ -294,10 +621,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
 
-    //当url为/时，显示欢迎界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
-
     //请求行处理完毕，将主状态机转移处理请求头
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
@@ -310,63 +633,250 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     if (text[0] == '\0')
     {
         //判断是GET还是POST请求
+        if (m_chunked)
+        {
+            if (m_known[HDR_CONTENT_LENGTH].value)
+                m_linger = false;
+            m_check_state = CHECK_STATE_CONTENT;
+            m_body_state = BODY_CHUNK_SIZE;
+            return NO_REQUEST;
+        }
         if (m_content_length != 0)
         {
             // 是POST，需要跳转到消息体处理状态
             m_check_state = CHECK_STATE_CONTENT;
+            m_body_state = BODY_DATA;
+            m_body_left = m_content_length;
             return NO_REQUEST;
         }
+        m_form[0] = '\0';
+        m_string = m_form;
         return GET_REQUEST;
     }
-    //解析请求头部连接字段
-    else if (strncasecmp(text, "Connection:", 11) == 0)
-    {
-        text += 11;
 
-        //跳过空格和\t字符
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+    //头部名称到冒号为止，值去掉两端的空格和\t；行尾已被parse_line改为\0
+    char *end = m_read_buf + m_checked_idx - 2;
+    char *colon = (char *)memchr(text, ':', end - text);
+    if (!colon || colon == text)
+        return BAD_REQUEST;
+    char *value = skip_blank(colon + 1, end);
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+        *--end = '\0';
+
+    header_field field;
+    field.name = text - m_read_buf;
+    field.name_len = colon - text;
+    field.value = value - m_read_buf;
+    field.value_len = end - value;
+    if (m_header_count < MAX_HEADERS)
+        m_headers[m_header_count++] = field;
+
+    int id = header_lookup(text, field.name_len);
+    if (id < 0)
+        return NO_REQUEST;
+    m_known[id] = field;
+
+    //解析时就需要的字段
+    switch (id)
+    {
+    case HDR_CONNECTION:
+    {
+        //值为逗号分隔的选项列表，如"keep-alive, Upgrade"；close优先
+        char *p = value;
+        while (p < end)
         {
-            //如果是长连接，则将linger标志设置为true
-            m_linger = true;
+            char *comma = (char *)memchr(p, ',', end - p);
+            char *token_end = comma ? comma : end;
+            while (token_end > p && (token_end[-1] == ' ' || token_end[-1] == '\t'))
+                --token_end;
+            int len = token_end - p;
+            if (len == 5 && strncasecmp(p, "close", 5) == 0)
+            {
+                m_linger = false;
+                break;
+            }
+            if (len == 10 && strncasecmp(p, "keep-alive", 10) == 0)
+                m_linger = true;
+            if (!comma)
+                break;
+            p = skip_blank(comma + 1, end);
         }
+        break;
     }
-    //解析请求头部内容长度字段
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    case HDR_CONTENT_LENGTH:
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        char *digits_end;
+        m_content_length = strtoll(value, &digits_end, 10);
+        if (digits_end == value || *digits_end != '\0' || m_content_length < 0)
+            return BAD_REQUEST;
+        break;
     }
-    //解析请求头部HOST字段
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    case HDR_TRANSFER_ENCODING:
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        //只支持chunked；同时有Content-Length时以chunked为准，响应后关闭连接，避免二者不一致造成请求走私
+        if (strcasecmp(value, "chunked") != 0)
+            return BAD_REQUEST;
+        m_chunked = true;
+        break;
     }
-    else
+    case HDR_HOST:
     {
-        // printf("oop!unknow header: %s\n", text);
-        LOG_INFO("oop!unknow header: %s", text);
-        Log::get_instance()->flush();
+        m_host = value;
+        break;
+    }
+    default:
+        break;
     }
     return NO_REQUEST;
 }
 
+const char *http_conn::find_header(const char *name, int *len) const
+{
+    int name_len = strlen(name);
+    int id = header_lookup(name, name_len);
+    if (id >= 0)
+        return header(id, len);
+
+    for (int i = 0; i < m_header_count; ++i)
+    {
+        const header_field &field = m_headers[i];
+        if (field.name_len == name_len && strncasecmp(m_read_buf + field.name, name, name_len) == 0)
+        {
+            if (len)
+                *len = field.value_len;
+            return m_read_buf + field.value;
+        }
+    }
+    return NULL;
+}
+
 //判断http请求是否被完整读入
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
+http_conn::HTTP_CODE http_conn::parse_content()
 {
-    //判断buffer中是否读取了消息体
-    if (m_read_idx >= (m_content_length + m_checked_idx))
+    char *begin = m_read_buf + m_checked_idx;
+    char *p = begin;
+    char *end = m_read_buf + m_read_idx;
+    HTTP_CODE ret = NO_REQUEST;
+    bool more = false;
+    while (ret == NO_REQUEST && !more && p < end)
+    {
+        switch (m_body_state)
+        {
+        case BODY_DATA:
+        {
+            int n = end - p < m_body_left ? end - p : (int)m_body_left;
+            consume_body(p, n);
+            p += n;
+            m_body_left -= n;
+            if (m_body_left == 0)
+            {
+                if (!m_chunked)
+                    ret = GET_REQUEST;
+                else
+                    m_body_state = BODY_CHUNK_END;
+            }
+            break;
+        }
+        case BODY_CHUNK_SIZE:
+        {
+            //块大小为十六进制，之后可能有;开头的扩展，忽略
+            char *lf = (char *)memchr(p, '\n', end - p);
+            if (!lf)
+            {
+                if (end - p > MAX_CHUNK_LINE)
+                    ret = BAD_REQUEST;
+                more = true;
+                break;
+            }
+            long long size = 0;
+            char *q = p;
+            for (; q < lf; ++q)
+            {
+                int d;
+                if (*q >= '0' && *q <= '9')
+                    d = *q - '0';
+                else if ((*q | 0x20) >= 'a' && (*q | 0x20) <= 'f')
+                    d = (*q | 0x20) - 'a' + 10;
+                else
+                    break;
+                //块大小不超过2^40
+                if (size >> 36)
+                    return BAD_REQUEST;
+                size = size * 16 + d;
+            }
+            if (q == p || (*q != ';' && *q != ' ' && *q != '\t' && *q != '\r'))
+                return BAD_REQUEST;
+            p = lf + 1;
+            if (size == 0)
+                m_body_state = BODY_TRAILER;
+            else
+            {
+                m_body_left = size;
+                m_body_state = BODY_DATA;
+            }
+            break;
+        }
+        case BODY_CHUNK_END:
+        {
+            if (end - p < 2)
+            {
+                more = true;
+                break;
+            }
+            if (p[0] != '\r' || p[1] != '\n')
+                return BAD_REQUEST;
+            p += 2;
+            m_body_state = BODY_CHUNK_SIZE;
+            break;
+        }
+        case BODY_TRAILER:
+        {
+            //逐行丢弃trailer，空行表示消息体结束
+            char *lf = (char *)memchr(p, '\n', end - p);
+            if (!lf)
+            {
+                more = true;
+                break;
+            }
+            if (lf == p || (lf == p + 1 && *p == '\r'))
+                ret = GET_REQUEST;
+            p = lf + 1;
+            break;
+        }
+        }
+    }
+
+    //已处理的消息体从读缓冲区移除，之后的数据(未完整的块大小行或下一个流水线请求)前移
+    if (p != begin)
+    {
+        memmove(begin, p, end - p);
+        m_read_idx -= p - begin;
+    }
+    //读缓冲区已满仍无法继续，如请求头占满了缓冲区
+    if (ret == NO_REQUEST && m_read_idx == READ_BUFFER_SIZE)
+        return BAD_REQUEST;
+    if (ret == GET_REQUEST)
     {
-        text[m_content_length] = '\0';
         // POST请求中最后为输入的用户名和密码
-        m_string = text;
+        m_form[m_form_len] = '\0';
+        m_string = m_form;
+    }
+    return ret;
+}
 
-        return GET_REQUEST;
+void http_conn::consume_body(const char *data, int len)
+{
+    //只有登录、注册请求使用消息体
+    if (!cgi)
+        return;
+    int n = len;
+    if (n > FORM_SIZE - m_form_len)
+    {
+        n = FORM_SIZE - m_form_len;
+        m_form_overflow = true;
     }
-    return NO_REQUEST;
+    memcpy(m_form + m_form_len, data, n);
+    m_form_len += n;
 }
 
 //解析报文整体流程
@@ -377,8 +887,22 @@ http_conn::HTTP_CODE http_conn::process_read()
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
 
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
+    while (true)
     {
+        //消息体不按行处理
+        if (m_check_state == CHECK_STATE_CONTENT)
+        {
+            //解析消息体
+            ret = parse_content();
+
+            //完整解析POST请求后，跳转到报文响应函数
+            if (ret == GET_REQUEST)
+                return do_request();
+            return ret;
+        }
+        if ((line_status = parse_line()) != LINE_OK)
+            break;
+
         // m_start_line是每一个数据行在m_read_buf中的起始位置
         // m_checked_idx表示从状态机在m_read_buf中读取的位置
         text = get_line();
@@ -418,19 +942,6 @@ http_conn::HTTP_CODE http_conn::process_read()
             }
             break;
         }
-        case CHECK_STATE_CONTENT:
-        {
-            //解析消息体
-            ret = parse_content(text);
-
-            //完整解析POST请求后，跳转到报文响应函数
-            if (ret == GET_REQUEST)
-                return do_request();
-
-            //解析完消息体即完成报文解析，避免再次进入循环，更新line_status
-            line_status = LINE_OPEN;
-            break;
-        }
         default:
             return INTERNAL_ERROR;
         }
@@ -438,132 +949,100 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
+//生成响应：按方法和路径在路由表中查找处理函数，没有注册的路径作为网站根目录下的静态文件
 http_conn::HTTP_CODE http_conn::do_request()
 {
-    //将初始化的m_real_file赋值为网站根目录
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
+    const route_table<route_handler>::route *r = routes.find(m_method, m_url, strlen(m_url));
+    if (r)
+        return (this->*r->handler)(r->arg);
+    return serve_file(m_url);
+}
+
+bool http_conn::parse_form(char *name, char *password)
+{
+    //表单超出长度或格式不是user=...&password=...
+    if (m_form_overflow || strncmp(m_string, "user=", 5) != 0 || !strstr(m_string, "&password="))
+        return false;
 
-    //找到m_url中/的位置
-    const char *p = strrchr(m_url, '/');
+    // utf8转中文
+    string temp = UTF8Url::Decode(m_string);
+    strcpy(m_string, temp.c_str());
 
-    //实现登录和注册校验
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
+    //将用户名和密码提取出来，表单不超过FORM_SIZE，解码后只会更短
+    int i;
+    for (i = 5; m_string[i] != '&'; i++)
     {
-        // 根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcpy(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
+        name[i - 5] = m_string[i];
+    }
+    name[i - 5] = '\0';
 
-        // utf8转中文
-        string temp = UTF8Url::Decode(m_string);
-        strcpy(m_string, temp.c_str());
+    int j = 0;
+    for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
+        password[j] = m_string[i];
+    password[j] = '\0';
+    return true;
+}
 
-        //将用户名和密码提取出来
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; i++)
-        {
-            name[i - 5] = m_string[i];
-        }
-        name[i - 5] = '\0';
+//登录：浏览器端输入的用户名和密码在表中可以查找到则跳转欢迎页面
+http_conn::HTTP_CODE http_conn::serve_login(const char *)
+{
+    char name[FORM_SIZE], password[FORM_SIZE];
+    if (!parse_form(name, password))
+        return BAD_REQUEST;
+
+    users_lock.lock();
+    map<string, string>::iterator it = users.find(name);
+    bool ok = it != users.end() && it->second == password;
+    users_lock.unlock();
+    return serve_file(ok ? "/welcome.html" : "/logError.html");
+}
 
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
+//注册：先检测数据库中是否有重名的，没有重名的，进行增加数据
+http_conn::HTTP_CODE http_conn::serve_register(const char *)
+{
+    char name[FORM_SIZE], password[FORM_SIZE];
+    if (!parse_form(name, password))
+        return BAD_REQUEST;
 
-        // 同步线程登录校验
-        pthread_mutex_t lock;
-        pthread_mutex_init(&lock, NULL);
+    char sql_insert[2 * FORM_SIZE + 64];
+    snprintf(sql_insert, sizeof(sql_insert), "INSERT INTO user(username, passwd) VALUES('%s', '%s')", name, password);
 
+    //查重和插入在同一把锁内完成，同名的并发注册只有一个成功
+    const char *page = "/registerError.html";
+    users_lock.lock();
+    if (users.find(name) == users.end())
+    {
         //从连接池中取一个连接
         MYSQL *mysql = connPool->GetConnection();
-
-        //如果是注册，先检测数据库中是否有重名的
-        //没有重名的，进行增加数据
-        char *sql_insert = (char *)malloc(sizeof(char) * 200);
-        strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-        strcat(sql_insert, "'");
-        strcat(sql_insert, name);
-        strcat(sql_insert, "', '");
-        strcat(sql_insert, password);
-        strcat(sql_insert, "')");
-
-        //注册
-        if (*(p + 1) == '3')
-        {
-            //未找到
-            if (users.find(name) == users.end())
-            {
-                pthread_mutex_lock(&lock);
-                int res = mysql_query(mysql, sql_insert);
-                // printf("%s%s%d\n", sql_insert, "查询结果：", res);
-
-                users.insert(pair<string, string>(name, password));
-                pthread_mutex_unlock(&lock);
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
+        int res = mysql_query(mysql, sql_insert);
+        connPool->ReleaseConnection(mysql);
+        if (!res)
         {
-            // printf("%s%s%s%s\n", "do_request()接收到的用户: ", name, "密码: ", password);
-
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
+            users.insert(pair<string, string>(name, password));
+            page = "/log.html";
         }
-        connPool->ReleaseConnection(mysql);
-    }
-
-    //如果请求资源为/0，表示跳转注册界面
-    if (*(p + 1) == '0')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-
-        //将网站目录和/register.html进行拼接，更新到m_real_file中
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
-    }
-    //如果请求资源为/1，表示跳转登录界面
-    else if (*(p + 1) == '1')
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-
-        //将网站目录和/log.html进行拼接，更新到m_real_file中
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
-    }
-    else
-    {
-        // printf("%s\n", "请求文件");
-        //如果以上均不符合，即不是登录和注册，直接将url与网站目录拼接
-        //这里的情况是welcome界面，请求服务器上的一个图片
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
     }
+    users_lock.unlock();
+    return serve_file(page);
+}
 
-    //通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
-    //失败返回NO_RESOURCE状态，表示资源不存在
-    if (stat(m_real_file, &m_file_stat) < 0)
+http_conn::HTTP_CODE http_conn::serve_file(const char *path)
+{
+    //将网站根目录和请求的路径拼接为m_real_file
+    int len = strlen(doc_root);
+    memcpy(m_real_file, doc_root, len);
+    strncpy(m_real_file + len, path, FILENAME_LEN - len - 1);
+    m_real_file[FILENAME_LEN - 1] = '\0';
+
+    //从文件缓存取得请求资源的stat信息、描述符或映射，命中时没有任何文件系统调用
+    //失败返回NO_RESOURCE状态，表示资源不存在；不存在的路径同样被缓存
+    m_file = file_cache::get_instance()->acquire(m_real_file);
+    if (m_file->err)
     {
         // printf("%s\n", "资源不存在");
-        return NO_REQUEST;
+        return NO_RESOURCE;
     }
+    m_file_stat = m_file->st;
 
     //判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态
     if (!(m_file_stat.st_mode & S_IROTH))
@@ -579,286 +1058,870 @@ http_conn::HTTP_CODE http_conn::do_request()
         return BAD_REQUEST;
     }
 
-    // printf("%s\n", "文件打开中...");
-    //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    // printf("%s%s\n", "m_file_address: ", m_file_address);
+    //空文件不需要映射
+    if (m_file_stat.st_size == 0)
+        return FILE_REQUEST;
+    //小文件在缓存中有共享的只读映射；大文件有描述符，由sendfile在内核中直接发送，避免用户态缺页和munmap时的TLB shootdown
+    //都没有时为设备等特殊文件
+    if (!m_file->addr && m_file->fd < 0)
+        return INTERNAL_ERROR;
+    m_file_address = m_file->addr;
+
+    //可压缩的文件按Accept-Encoding选择表示，无论是否压缩响应都带Vary
+    bool compressible;
+    m_content_type = mime_type(m_real_file, compressible);
+    if (compressible)
+    {
+        m_vary = true;
+        select_encoding();
+    }
 
-    //避免文件描述符的浪费和占用
-    close(fd);
+    //缓存验证器和按路径(网站根目录下的文件路径)的缓存策略；GET请求的验证器与客户端缓存的一致时回复304
+    m_cache_headers = true;
+    for (size_t i = 0; i < cache_policies.size(); ++i)
+    {
+        if (strncmp(path, cache_policies[i].prefix.c_str(), cache_policies[i].prefix.size()) == 0)
+        {
+            m_policy = &cache_policies[i];
+            break;
+        }
+    }
+    if (m_method == GET && not_modified())
+        return NOT_MODIFIED;
+
+    // Range只用于GET请求未压缩的表示；If-Range与当前的验证器不一致时发送整个文件
+    const char *range = header(HDR_RANGE);
+    if (range && m_method == GET && m_encoding == ENC_IDENTITY && if_range())
+    {
+        m_range_count = parse_range(range);
+        if (m_range_count == 0)
+            return RANGE_NOT_SATISFIABLE;
+        if (m_range_count > 0)
+            return PARTIAL_CONTENT;
+        m_range_count = 0;
+    }
 
     //表示请求文件存在，且可以访问
     return FILE_REQUEST;
 }
 
-void http_conn::unmap()
+bool http_conn::etag_equal(const char *tag, int len) const
 {
-    if (m_file_address)
+    const char *suffix = etag_suffix(m_encoding);
+    int base_len = strlen(m_file->etag);
+    int suffix_len = strlen(suffix);
+    return len == base_len + suffix_len && memcmp(tag, m_file->etag, base_len) == 0 &&
+           memcmp(tag + base_len, suffix, suffix_len) == 0;
+}
+
+bool http_conn::not_modified() const
+{
+    // If-None-Match为实体标签列表，按弱比较(忽略W/)；*匹配任何存在的文件
+    const char *list = header(HDR_IF_NONE_MATCH);
+    if (list)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        const char *p = list;
+        while (true)
+        {
+            p += strspn(p, " \t,");
+            if (*p == '*')
+                return true;
+            if (strncmp(p, "W/", 2) == 0)
+                p += 2;
+            const char *end = *p == '"' ? strchr(p + 1, '"') : NULL;
+            if (!end)
+                return false;
+            if (etag_equal(p + 1, end - p - 1))
+                return true;
+            p = end + 1;
+        }
     }
+
+    //没有If-None-Match时按修改时间判断，无法解析或晚于当前时间的日期被忽略
+    const char *since = header(HDR_IF_MODIFIED_SINCE);
+    if (!since)
+        return false;
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!strptime(since, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+        return false;
+    time_t t = timegm(&tm);
+    return t <= time(NULL) && m_file_stat.st_mtime <= t;
 }
 
-bool http_conn::write()
+bool http_conn::if_range() const
 {
-    int temp = 0;
+    int len;
+    const char *value = header(HDR_IF_RANGE, &len);
+    if (!value)
+        return true;
+    if (*value == '"')
+        return len >= 2 && value[len - 1] == '"' && etag_equal(value + 1, len - 2);
+    return strcmp(value, m_file->last_modified) == 0;
+}
 
-    bytes_have_send = 0;
-    bytes_to_send = m_write_idx;
+//十进制的非负整数，没有数字时返回-1，溢出时为LLONG_MAX
+static long long range_number(const char *p, const char **end)
+{
+    *end = p;
+    if (*p < '0' || *p > '9')
+        return -1;
+    char *num_end;
+    long long n = strtoll(p, &num_end, 10);
+    *end = num_end;
+    return n;
+}
 
-    int newadd = 0;
+int http_conn::parse_range(const char *value)
+{
+    if (strncasecmp(value, "bytes=", 6) != 0)
+        return -1;
+    long long size = m_file_stat.st_size;
+
+    //合并前最多接受的区间数，拒绝大量细碎的区间
+    byte_range ranges[4 * MAX_RANGES];
+    int count = 0;
+    bool empty = true;
+    const char *p = value + 6;
+    while (true)
+    {
+        p += strspn(p, " \t,");
+        if (!*p)
+            break;
+        empty = false;
+        long long first, last;
+        const char *end;
+        if (*p == '-')
+        {
+            //后缀区间：最后n个字节，n为0时不可满足
+            long long n = range_number(p + 1, &end);
+            if (n < 0)
+                return -1;
+            first = n == 0 ? size : n < size ? size - n : 0;
+            last = size - 1;
+        }
+        else
+        {
+            //起始位置超出文件的区间不可满足，结束位置超出时截到文件末尾
+            first = range_number(p, &end);
+            if (first < 0 || *end != '-')
+                return -1;
+            last = range_number(end + 1, &end);
+            if (last < 0)
+                last = size - 1;
+            else if (last < first)
+                return -1;
+            else if (last >= size)
+                last = size - 1;
+        }
+        p = end + strspn(end, " \t");
+        if (*p && *p != ',')
+            return -1;
+        if (first >= size)
+            continue;
+        if (count == 4 * MAX_RANGES)
+            return -1;
+        ranges[count].first = first;
+        ranges[count].last = last;
+        ++count;
+    }
+    if (empty)
+        return -1;
 
-    //若要发送的数据长度为0
-    //表示响应报文为空，一般不会出现这种情况
-    if (bytes_to_send == 0)
+    //按起始位置排序，合并重叠或相邻的区间
+    for (int i = 1; i < count; ++i)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
-        return true;
+        byte_range r = ranges[i];
+        int j = i;
+        for (; j > 0 && ranges[j - 1].first > r.first; --j)
+            ranges[j] = ranges[j - 1];
+        ranges[j] = r;
     }
+    int merged = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (merged > 0 && ranges[i].first <= m_ranges[merged - 1].last + 1)
+        {
+            if (ranges[i].last > m_ranges[merged - 1].last)
+                m_ranges[merged - 1].last = ranges[i].last;
+            continue;
+        }
+        if (merged == MAX_RANGES)
+            return -1;
+        m_ranges[merged++] = ranges[i];
+    }
+    return merged;
+}
 
-    while (true)
+bool http_conn::expires() const
+{
+    return m_policy && m_policy->max_age >= 0 && m_version[7] == '0';
+}
+
+void http_conn::select_encoding()
+{
+    const char *value = header(HDR_ACCEPT_ENCODING);
+    int accept = value ? accept_encoding(value) : 0;
+    if ((accept & (1 << ENC_BR)) && use_precompressed(ENC_BR, ".br"))
+        return;
+    if (!(accept & (1 << ENC_GZIP)) || use_precompressed(ENC_GZIP, ".gz"))
+        return;
+
+    //没有预压缩文件时即时压缩；只压缩缓存中的条目，否则每个请求都要重新压缩
+    if (!m_file->cached || m_file_stat.st_size < GZIP_MIN || m_file_stat.st_size > GZIP_MAX)
+        return;
+    const file_buf *gz = gzip_body();
+    if (!gz || gz->len == 0)
+        return;
+    m_encoding = ENC_GZIP;
+    m_file_address = (char *)gz->data;
+    m_file_stat.st_size = gz->len;
+}
+
+bool http_conn::use_precompressed(CONTENT_ENCODING enc, const char *suffix)
+{
+    int len = strlen(m_real_file);
+    int suffix_len = strlen(suffix);
+    if (len + suffix_len >= FILENAME_LEN)
+        return false;
+    memcpy(m_real_file + len, suffix, suffix_len + 1);
+    //预压缩文件与原文件一样经过文件缓存，不存在的路径同样被缓存
+    file_entry *entry = file_cache::get_instance()->acquire(m_real_file);
+    m_real_file[len] = '\0';
+
+    //必须是可读的非空普通文件，修改时间早于原文件时视为过期
+    if (entry->err || !S_ISREG(entry->st.st_mode) || !(entry->st.st_mode & S_IROTH) || entry->st.st_size == 0 ||
+        (!entry->addr && entry->fd < 0) || entry->st.st_mtime < m_file_stat.st_mtime)
     {
-        //将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        file_cache::get_instance()->release(entry);
+        return false;
+    }
+    file_cache::get_instance()->release(m_file);
+    m_file = entry;
+    m_file_stat = entry->st;
+    m_file_address = entry->addr;
+    m_encoding = enc;
+    return true;
+}
 
-        if (temp >= 0)
+const file_buf *http_conn::gzip_body()
+{
+    file_buf *gz = __atomic_load_n(&m_file->gzip, __ATOMIC_ACQUIRE);
+    if (gz)
+        return gz;
+
+    //用sendfile发送的文件没有映射，先读入内存
+    int size = m_file_stat.st_size;
+    char *src = m_file->addr;
+    if (!src)
+    {
+        src = (char *)malloc(size);
+        if (!src)
+            return NULL;
+        int n = 0;
+        while (n < size)
         {
-            //更新已发送字节
-            bytes_have_send += temp;
-
-            //偏移 文件 iovec的指针
-            newadd = bytes_have_send - m_write_idx;
+            ssize_t ret = pread(m_file->fd, src + n, size - n, n);
+            if (ret <= 0)
+                break;
+            n += ret;
         }
-        else
+        if (n < size)
         {
-            //判断缓冲区是否满了
-            if (errno == EAGAIN)
-            {
-                //第一个iovec头部信息的数据已发送完，发送第二个iovec数据
-                if (bytes_have_send >= m_iv[0].iov_len)
-                {
-                    //不再继续发送头部信息
-                    m_iv[0].iov_len = 0;
-                    m_iv[1].iov_base = m_file_address + newadd;
-                    m_iv[1].iov_len = bytes_to_send;
-                }
-                //继续发送第一个iovec头部信息的数据
-                else
-                {
-                    m_iv[0].iov_base = m_write_buf + bytes_have_send;
-                    m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-                }
-                //重新注册写事件
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
-                // printf("%s\n", "write()注册了写事件");
-                return true;
-            }
-            //如果发送失败，但不是缓冲区问题，取消映射
-            unmap();
-            return false;
+            free(src);
+            return NULL;
         }
+    }
 
-        //更新已发送字节数
-        bytes_to_send -= temp;
-
-        //判断条件，数据已全部发送完
-        if (bytes_to_send <= 0)
+    // windowBits加16生成gzip格式；压缩失败或没有变小时len为0，之后不再尝试
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+    {
+        uLong bound = deflateBound(&zs, size);
+        gz = (file_buf *)malloc(sizeof(file_buf) + bound);
+        if (gz)
         {
-            unmap();
+            zs.next_in = (Bytef *)src;
+            zs.avail_in = size;
+            zs.next_out = (Bytef *)gz->data;
+            zs.avail_out = bound;
+            gz->len = 0;
+            if (deflate(&zs, Z_FINISH) == Z_STREAM_END && (int)zs.total_out < size)
+                gz->len = zs.total_out;
+            file_buf *shrunk = (file_buf *)realloc(gz, sizeof(file_buf) + gz->len);
+            if (shrunk)
+                gz = shrunk;
+        }
+        deflateEnd(&zs);
+    }
+    if (src != m_file->addr)
+        free(src);
+    if (!gz)
+        return NULL;
+
+    //多个线程同时压缩时只保留先发布的一份
+    file_buf *expected = NULL;
+    if (!__atomic_compare_exchange_n(&m_file->gzip, &expected, gz, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        free(gz);
+        gz = expected;
+    }
+    return gz;
+}
+
+void http_conn::unmap_file()
+{
+    if (m_file)
+    {
+        file_cache::get_instance()->release(m_file);
+        m_file = NULL;
+    }
+    m_file_address = 0;
+}
 
-            //在epoll树上重置EPOLLONESHOT事件
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+void http_conn::unmap()
+{
+    unmap_file();
+    for (int i = 0; i < m_file_count; ++i)
+        file_cache::get_instance()->release(m_files[i]);
+    m_file_count = 0;
+    m_send_fd = -1;
+    //iovec引用的文件已经释放，段归还到池中
+    m_out.clear();
+    if (m_range_map)
+    {
+        munmap(m_range_map, m_range_map_len);
+        m_range_map = NULL;
+    }
+}
+
+int http_conn::send_file()
+{
+    //sendfile更新m_send_off，部分发送后从该位置继续
+    return sendfile(m_sockfd, m_send_fd, &m_send_off, m_send_end - m_send_off);
+}
 
-            //浏览器的请求为长连接
-            if (m_linger)
+bool http_conn::write()
+{
+    //没有数据待发送，表示工作线程生成响应失败，返回false由反应堆关闭连接
+    if (m_out.empty())
+        return false;
+
+    while (true)
+    {
+        int count = 0;
+        struct iovec *iov = write_iov(count);
+        int temp;
+        if (count > 0)
+        {
+            //将本批所有响应的状态行、消息头、空行和映射的响应正文一次发送给浏览器端
+            //之后还要sendfile时带MSG_MORE，响应头与文件开头合并为完整的TCP段
+            //只有一段时(如预先生成的响应)直接send；超过IOV_MAX段时分次发送
+            int flags = file_pending() ? MSG_MORE : 0;
+            if (count > IOV_MAX)
             {
-                //重新初始化HTTP对象
-                init();
-                return true;
+                count = IOV_MAX;
+                flags |= MSG_MORE;
             }
+            if (count == 1)
+                temp = send(m_sockfd, iov->iov_base, iov->iov_len, flags);
             else
             {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = count;
+                temp = sendmsg(m_sockfd, &msg, flags);
+            }
+            if (temp > 0)
+                write_advance(temp);
+        }
+        else if (file_pending())
+        {
+            temp = send_file();
+            //文件在发送过程中被截短
+            if (temp == 0)
+            {
+                unmap();
                 return false;
             }
         }
+        else
+        {
+            //数据已全部发送完
+            //短连接关闭；长连接在读缓冲区中没有后续请求时注册读事件，有则由反应堆交给线程池
+            if (!write_done())
+                return false;
+            if (!pipelined())
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
+            return true;
+        }
+
+        if (temp < 0)
+        {
+            //发送缓冲区满，重新注册写事件，从已发送的位置继续
+            if (errno == EAGAIN)
+            {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                return true;
+            }
+            //如果发送失败，但不是缓冲区问题，取消映射
+            unmap();
+            return false;
+        }
     }
 }
 
-//写入写缓存
-bool http_conn::add_response(const char *format, ...)
+struct iovec *http_conn::write_iov(int &count)
 {
-    //如果写入内容超出m_write_buf大小则报错
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
-        return false;
-
-    //定义可变参数列表
-    va_list arg_list;
-
-    //将变量arg_list初始化为传入参数
-    va_start(arg_list, format);
+    //发送缓冲区记录了第一个未发送完的iovec及其中已发送的位置
+    return m_out.iov(count);
+}
 
-    //将数据format从可变参数列表写入缓冲区，返回写入数据的长度
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+bool http_conn::write_advance(int len)
+{
+    return m_out.advance(len);
+}
 
-    //如果写入的数据长度超过缓冲区剩余空间，则报错
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+bool http_conn::write_done()
+{
+    if (!m_keep_alive)
     {
-        va_end(arg_list);
+        unmap();
         return false;
     }
+    next_batch();
+    return true;
+}
 
-    //更新m_write_idx位置
-    m_write_idx += len;
-    //清空可变参列表
-    va_end(arg_list);
-
-    LOG_INFO("request:%s", m_write_buf);
-    Log::get_instance()->flush();
+//写入发送缓冲区，当前段写满时接着写入新段，长度不受限制
+bool http_conn::add_bytes(const char *data, int len)
+{
+    return m_out.append(data, len);
+}
 
-    return true;
+bool http_conn::add_number(unsigned long long value)
+{
+    //从低位向高位每次写两位
+    char buf[20];
+    char *p = buf + sizeof(buf);
+    while (value >= 100)
+    {
+        int pair = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = digit_pairs[pair];
+        p[1] = digit_pairs[pair + 1];
+    }
+    if (value >= 10)
+    {
+        p -= 2;
+        p[0] = digit_pairs[value * 2];
+        p[1] = digit_pairs[value * 2 + 1];
+    }
+    else
+        *--p = '0' + value;
+    return add_bytes(p, buf + sizeof(buf) - p);
 }
 
 //添加状态行
-bool http_conn::add_status_line(int status, const char *title)
+bool http_conn::add_status_line(int status)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    switch (status)
+    {
+    case 200:
+        return add_literal(STATUS_200);
+    case 206:
+        return add_literal(STATUS_206);
+    case 304:
+        return add_literal(STATUS_304);
+    case 416:
+        return add_literal(STATUS_416);
+    default:
+        return false;
+    }
 }
 
 //添加消息报头，具体的添加文本长度、连接状态和空行
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(long long content_len)
 {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+    return add_content_length(content_len) && add_content_type() && add_content_encoding() && add_vary() &&
+           add_cache_headers() && add_accept_ranges() && add_linger() && add_blank_line();
 }
 
 //添加Content-Length，表示响应报文的长度
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(long long content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return add_literal("Content-Length:") && add_number(content_len) && add_literal("\r\n");
 }
 
-//添加文本类型，这里是html
+//添加Content-Range，闭区间[first, last]
+bool http_conn::add_content_range(long long first, long long last, long long size)
+{
+    return add_literal("Content-Range:bytes ") && add_number(first) && add_literal("-") && add_number(last) &&
+           add_literal("/") && add_number(size) && add_literal("\r\n");
+}
+
+//添加文本类型，由文件扩展名决定，没有时不添加
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    if (!m_content_type)
+        return true;
+    return add_literal("Content-Type:") && add_bytes(m_content_type, strlen(m_content_type)) && add_literal("\r\n");
+}
+
+//添加内容编码
+bool http_conn::add_content_encoding()
+{
+    if (m_encoding == ENC_IDENTITY)
+        return true;
+    return m_encoding == ENC_GZIP ? add_literal("Content-Encoding:gzip\r\n") : add_literal("Content-Encoding:br\r\n");
+}
+
+//可压缩的文件无论是否压缩都带Vary，使代理按Accept-Encoding分别缓存
+bool http_conn::add_vary()
+{
+    return !m_vary || add_literal("Vary:Accept-Encoding\r\n");
+}
+
+//未压缩的文件支持Range请求
+bool http_conn::add_accept_ranges()
+{
+    return !m_cache_headers || m_encoding != ENC_IDENTITY || add_literal("Accept-Ranges:bytes\r\n");
+}
+
+//添加ETag、Last-Modified和缓存策略
+bool http_conn::add_cache_headers()
+{
+    if (!m_cache_headers)
+        return true;
+    const char *suffix = etag_suffix(m_encoding);
+    if (!add_literal("ETag:\"") || !add_bytes(m_file->etag, strlen(m_file->etag)) || !add_bytes(suffix, strlen(suffix)) ||
+        !add_literal("\"\r\nLast-Modified:") || !add_bytes(m_file->last_modified, strlen(m_file->last_modified)) ||
+        !add_literal("\r\n"))
+        return false;
+    if (!m_policy)
+        return true;
+    if (!add_literal("Cache-Control:") || !add_bytes(m_policy->value.data(), m_policy->value.size()) || !add_literal("\r\n"))
+        return false;
+    // HTTP/1.0的缓存不认识Cache-Control，另外按max-age给出Expires
+    if (!expires())
+        return true;
+    char date[32];
+    time_t t = time(NULL) + m_policy->max_age;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    int len = strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return add_literal("Expires:") && add_bytes(date, len) && add_literal("\r\n");
 }
 
 //添加连接状态，通知浏览器端是保持连接还是关闭
 bool http_conn::add_linger()
 {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    return m_linger ? add_literal("Connection:keep-alive\r\n") : add_literal("Connection:close\r\n");
 }
 
 //添加空行
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_literal("\r\n");
 }
 
 //添加文本content
 bool http_conn::add_content(const char *content)
 {
-    return add_response("%s", content);
+    return add_bytes(content, strlen(content));
+}
+
+const file_buf *http_conn::prerendered()
+{
+    //同一条目不同编码的响应头不同(Content-Encoding)，分别生成
+    file_buf **slot = &m_file->response[m_encoding][m_linger ? 1 : 0];
+    file_buf *res = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (res)
+        return res;
+
+    //第一次发送：借用发送缓冲区格式化状态行和消息头，保证与逐个响应格式化的结果完全一致，拷出后撤销，与文件内容一起保存
+    response_buffer::mark mark = m_out.get_mark();
+    if (!add_status_line(200) || !add_headers(m_file_stat.st_size))
+    {
+        m_out.rollback(mark);
+        return NULL;
+    }
+    int head_len = m_out.size() - mark.size;
+    res = (file_buf *)malloc(sizeof(file_buf) + head_len + m_file_stat.st_size);
+    if (res)
+    {
+        res->len = head_len + m_file_stat.st_size;
+        m_out.copy_since(mark, res->data);
+        memcpy(res->data + head_len, m_file_address, m_file_stat.st_size);
+    }
+    m_out.rollback(mark);
+    if (!res)
+        return NULL;
+
+    //多个线程同时生成时只保留先发布的一份
+    file_buf *expected = NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, res, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        free(res);
+        res = expected;
+    }
+    return res;
+}
+
+bool http_conn::add_ranges()
+{
+    long long size = m_file_stat.st_size;
+    if (m_range_count == 1)
+    {
+        //单个区间：与整个文件的响应相同，只是消息体为文件的一部分，大文件由sendfile从区间起始位置发送
+        const byte_range &r = m_ranges[0];
+        if (!add_content_length(r.last - r.first + 1) ||
+            !add_content_range(r.first, r.last, size) ||
+            !add_content_type() || !add_vary() || !add_cache_headers() || !add_linger() || !add_blank_line())
+            return false;
+        if (m_file_address)
+            m_out.append_ref(m_file_address + r.first, r.last - r.first + 1);
+        else
+        {
+            m_send_fd = m_file->fd;
+            m_send_off = r.first;
+            m_send_end = r.last + 1;
+        }
+        return true;
+    }
+
+    //多个区间：multipart/byteranges，用sendfile发送的大文件没有映射，为本次响应临时映射
+    char *data = m_file_address;
+    if (!data)
+    {
+        void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED, m_file->fd, 0);
+        if (addr == MAP_FAILED)
+            return false;
+        m_range_map = (char *)addr;
+        m_range_map_len = size;
+        data = m_range_map;
+    }
+
+    //各段的分隔行和段头直接追加到发送缓冲区，与引用的文件数据交替；Content-Length在此之前按各部分的长度算出
+    const int boundary_len = sizeof(range_boundary) - 1;
+    int type_len = m_content_type ? strlen(m_content_type) : 0;
+    long long total = sizeof("\r\n----\r\n") - 1 + boundary_len;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        const byte_range &r = m_ranges[i];
+        total += sizeof("\r\n--\r\nContent-Range:bytes -/\r\n\r\n") - 1 + boundary_len + decimal_len(r.first) +
+                 decimal_len(r.last) + decimal_len(size) + r.last - r.first + 1;
+        if (m_content_type)
+            total += sizeof("Content-Type:\r\n") - 1 + type_len;
+    }
+
+    if (!add_content_length(total) || !add_literal("Content-Type:multipart/byteranges; boundary=") ||
+        !add_bytes(range_boundary, boundary_len) || !add_literal("\r\n") ||
+        !add_vary() || !add_cache_headers() || !add_linger() || !add_blank_line())
+        return false;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        const byte_range &r = m_ranges[i];
+        if (!add_literal("\r\n--") || !add_bytes(range_boundary, boundary_len) || !add_literal("\r\n"))
+            return false;
+        if (m_content_type &&
+            (!add_literal("Content-Type:") || !add_bytes(m_content_type, type_len) || !add_literal("\r\n")))
+            return false;
+        if (!add_content_range(r.first, r.last, size) || !add_blank_line())
+            return false;
+        m_out.append_ref(data + r.first, r.last - r.first + 1);
+    }
+    return add_literal("\r\n--") && add_bytes(range_boundary, boundary_len) && add_literal("--\r\n");
 }
 
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    //生成的报文追加到发送缓冲区，文件映射和预先生成的报文只引用
     switch (ret)
     {
     //内部错误，500
     case INTERNAL_ERROR:
     {
-        //状态行
-        add_status_line(500, error_400_title);
-        //消息报头
-        add_headers(strlen(error_500_form));
-        if (!add_content(error_500_form))
-            return false;
-        break;
+        m_out.append_ref(error_500[m_linger].data(), error_500[m_linger].size());
+        return true;
     }
-    //报文语法有误，404
+    //报文语法有误，400，其后的数据无法可靠地划分为请求，响应后关闭连接
     case BAD_REQUEST:
     {
-        add_status_line(404, error_404_title);
-        add_headers(strlen(error_404_form));
-        if (!add_content(error_404_form))
-            return false;
-        break;
+        m_linger = false;
+        m_out.append_ref(error_400[0].data(), error_400[0].size());
+        return true;
+    }
+    //请求资源不存在，404
+    case NO_RESOURCE:
+    {
+        m_out.append_ref(error_404[m_linger].data(), error_404[m_linger].size());
+        return true;
     }
     //资源没有访问权限，403
     case FORBIDDEN_REQUEST:
     {
-        add_status_line(404, error_403_title);
-        add_headers(strlen(error_403_form));
-        if (!add_content(error_403_form))
+        m_out.append_ref(error_403[m_linger].data(), error_403[m_linger].size());
+        return true;
+    }
+    //客户端缓存的文件仍然有效，304，只有验证器和缓存策略，没有消息体
+    case NOT_MODIFIED:
+    {
+        if (!add_status_line(304) || !add_vary() || !add_cache_headers() || !add_linger() ||
+            !add_blank_line())
+            return false;
+        break;
+    }
+    //请求的部分区间，206
+    case PARTIAL_CONTENT:
+    {
+        if (m_file_count == MAX_PIPELINE || !add_status_line(206) || !add_ranges())
+            return false;
+        //缓存条目在本批响应发送完后统一释放
+        m_files[m_file_count++] = m_file;
+        m_file = NULL;
+        m_file_address = 0;
+        return true;
+    }
+    //区间都超出文件，416，Content-Range给出文件大小
+    case RANGE_NOT_SATISFIABLE:
+    {
+        if (!add_status_line(416) || !add_literal("Content-Range:bytes */") || !add_number(m_file_stat.st_size) ||
+            !add_literal("\r\n") || !add_content_length(0) ||
+            !add_linger() || !add_blank_line())
             return false;
         break;
     }
     //文件存在，200
     case FILE_REQUEST:
     {
-        add_status_line(200, ok_200_title);
         //如果请求的资源存在
         if (m_file_stat.st_size != 0)
         {
-            add_headers(m_file_stat.st_size);
-            //第一个iovec指针指向响应报文缓冲区，长度指向m_write_idx
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            //第二个iovec指针指向mmap返回的文件指针，长度指向文件大小
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            //发送的全部数据为响应报文头部信息和文件大小
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            if (m_file_count == MAX_PIPELINE)
+                return false;
+            //缓存中的小文件：整个响应已预先生成，一个iovec指向它，不再格式化
+            const file_buf *res = NULL;
+            if (m_file->cached && m_file_address && m_file_stat.st_size <= PRERENDER_MAX && !expires())
+                res = prerendered();
+            if (res)
+                m_out.append_ref(res->data, res->len);
+            else
+            {
+                if (!add_status_line(200) || !add_headers(m_file_stat.st_size))
+                    return false;
+                if (!m_file_address)
+                {
+                    //大文件：由sendfile发送，本批到此为止
+                    m_send_fd = m_file->fd;
+                    m_send_off = 0;
+                    m_send_end = m_file_stat.st_size;
+                }
+                else
+                {
+                    //一个iovec指向缓存中的文件映射或压缩后的内容
+                    m_out.append_ref(m_file_address, m_file_stat.st_size);
+                }
+            }
+            //缓存条目在本批响应发送完后统一释放，预先生成的响应随条目一起释放
+            m_files[m_file_count++] = m_file;
+            m_file = NULL;
+            m_file_address = 0;
             return true;
         }
         else
         {
             //如果请求的资源大小为0，则返回空白html文件
             const char *ok_string = "<html><body></body></html>";
-            add_headers(strlen(ok_string));
-            if (!add_content(ok_string))
+            if (!add_status_line(200) || !add_headers(strlen(ok_string)) || !add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    //除FILE_REQUEST状态外，其余状态只申请一个iovec，指向响应报文缓冲区
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
     return true;
 }
 
+void http_conn::reject()
+{
+    m_linger = false;
+    m_keep_alive = false;
+    m_out.clear();
+    m_out.append_ref(overload_503, sizeof(overload_503) - 1);
+
+    //注册写事件，由反应堆发送后关闭
+    rearm(EPOLLOUT);
+}
+
+bool http_conn::db_request() const
+{
+    //与do_request使用同一张路由表：POST请求的路径对应会阻塞的路由(登录、注册)
+    if (m_read_idx < 5 || memcmp(m_read_buf, "POST ", 5) != 0)
+        return false;
+    const char *path = m_read_buf + 5;
+    const char *end = (const char *)memchr(path, ' ', m_read_idx - 5);
+    if (!end)
+        return false;
+    const route_table<route_handler>::route *r = routes.find(POST, path, end - path);
+    return r && r->blocking;
+}
+
 void http_conn::process()
 {
-    // printf("%s\n", "process()开始解析报文");
-    //报文解析
-    HTTP_CODE read_ret = process_read();
+    //读缓冲区中可能有多个流水线请求，依次解析并把响应追加到发送缓冲区，一次writev发送
+    int served = 0;
+    bool failed = false;
+    while (true)
+    {
+        // printf("%s\n", "process()开始解析报文");
+        //报文解析
+        HTTP_CODE read_ret = process_read();
+
+        // NO_REQUEST，表示请求不完整，需要继续接收请求数据
+        if (read_ret == NO_REQUEST)
+            break;
+
+        //达到每个连接的请求数上限，本次响应后关闭连接
+        if (m_max_requests > 0 && ++m_requests >= m_max_requests)
+            m_linger = false;
+
+        //调用process_write完成报文响应，追加到发送缓冲区
+        response_buffer::mark mark = m_out.get_mark();
+        bool write_ret = process_write(read_ret);
+        finish_request();
+        if (!write_ret)
+        {
+            //本次响应生成失败，撤销其写入；已生成的响应照常发送，之后由反应堆关闭连接
+            //工作线程不直接关闭连接，避免连接槽位和定时器在反应堆中泄漏
+            unmap_file();
+            m_out.rollback(mark);
+            m_keep_alive = false;
+            failed = true;
+            break;
+        }
+        //报文有误时，其后的数据无法可靠地划分为请求
+        if (read_ret == BAD_REQUEST)
+            m_keep_alive = false;
+        ++served;
 
-    // NO_REQUEST，表示请求不完整，需要继续接收请求数据
-    if (read_ret == NO_REQUEST)
+        //短连接、本批响应已满、已有响应要用sendfile发送或临时映射了大文件、读缓冲区中没有后续数据时停止
+        if (!m_keep_alive || served == MAX_PIPELINE || m_send_fd >= 0 || m_range_map || !pipelined())
+            break;
+    }
+
+    if (served == 0 && !failed)
     {
         // printf("%s\n", "process() 报文不完整！");
         //注册并监听读事件（m_sockfd 已经加入epoll）
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        rearm(EPOLLIN);
         return;
     }
-    // printf("%s\n", "process()解析报文完毕");
-
-    //调用process_write完成报文响应，写入写缓存
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
-    {
-        close_conn();
-    }
-    //注册并监听写事件，写缓存输出
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    //注册并监听写事件，发送缓冲区输出
+    rearm(EPOLLOUT);
     // printf("%s\n", "process()注册了写事件");
-}
\ No newline at end of file
+}
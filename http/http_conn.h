@@ -1,3 +1,4 @@
+#pragma once
 #include <unistd.h>
 #include <signal.h>
 #include <sys/types.h>
@@ -17,11 +18,18 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #include "../utf8/utf8.h"
+#include "http_header.h"
+#include "http_buffer.h"
+#include "../cache/file_cache.h"
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 
+class reactor;
+struct cache_policy;
+
 class http_conn
 {
 public:
@@ -29,8 +37,24 @@ public:
     static const int FILENAME_LEN = 200;
     //设置读缓冲区m_read_buf大小
     static const int READ_BUFFER_SIZE = 2048;
-    //设置写缓冲区m_write_buf大小
-    static const int WRITE_BUFFER_SIZE = 1024;
+    //每个请求记录的请求头个数上限，超出的不进入通用列表，已知头部仍按编号记录
+    static const int MAX_HEADERS = 32;
+    //流水线：一次处理读缓冲区中最多这么多个请求，响应合并为一次writev
+    static const int MAX_PIPELINE = 8;
+    //登录、注册表单的最大长度，与do_request中用户名、密码和SQL语句的缓冲区相适应
+    //消息体边接收边交给处理函数，超出部分丢弃，请求按报文有误处理
+    static const int FORM_SIZE = 100;
+    // chunked编码中块大小行(含扩展)的最大长度
+    static const int MAX_CHUNK_LINE = 64;
+    //不小于该大小的文件用sendfile发送，不再mmap；较小的文件仍然mmap后与头部一起writev
+    static const int SENDFILE_THRESHOLD = 16 * 1024;
+    //不大于该大小的缓存文件预先生成完整的响应报文，命中时一次send发送，不再格式化消息头
+    static const int PRERENDER_MAX = 8 * 1024;
+    //可压缩的文件没有预压缩的.gz时即时压缩，过小的文件压缩后没有收益，过大的文件只在有预压缩文件时压缩发送
+    static const int GZIP_MIN = 256;
+    static const int GZIP_MAX = 1024 * 1024;
+    // Range请求合并重叠、相邻的区间后最多的区间数，超出时忽略Range发送整个文件
+    static const int MAX_RANGES = 4;
     //报文的请求方法，本项目只用到GET和POST
     enum METHOD
     {
@@ -51,6 +75,14 @@ public:
         CHECK_STATE_HEADER,          //解析请求头
         CHECK_STATE_CONTENT          //解析消息体，仅用于解析POST请求
     };
+    //消息体的状态，CHECK_STATE_CONTENT的子状态
+    enum BODY_STATE
+    {
+        BODY_DATA = 0,    //数据，Content-Length或当前块还剩m_body_left字节
+        BODY_CHUNK_SIZE,  // chunked：块大小行
+        BODY_CHUNK_END,   // chunked：块数据之后的\r\n
+        BODY_TRAILER      // chunked：大小为0的块之后的trailer，直到空行
+    };
     //报文解析的结果
     enum HTTP_CODE
     {
@@ -60,6 +92,9 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST, //资源禁止访问
         FILE_REQUEST,
+        NOT_MODIFIED, //条件请求的验证器与文件一致，回复304
+        PARTIAL_CONTENT,       // Range请求，回复206
+        RANGE_NOT_SATISFIABLE, // Range中的区间都超出文件，回复416
         INTERNAL_ERROR, //服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
         CLOSED_CONNECTION
     };
@@ -72,16 +107,19 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_busy(0) {}
     ~http_conn() {}
 
 public:
     //初始化套接字地址，函数内部会调用私有方法init
-    void init(int sockfd, const sockaddr_in &addr);
+    // epollfd为该连接所属反应堆的epoll句柄
+    // owner非空表示反应堆使用io_uring后端，事件重新注册通过owner->post完成
+    // max_requests为该连接最多处理的请求数，最后一个请求的响应带Connection: close，0为不限制
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, reactor *owner = NULL, int max_requests = 0);
     //关闭http连接
     void close_conn(bool real_close = true);
     void process();
-    //读取浏览器端发来的全部数据
+    //读取浏览器端发来的全部数据，读缓冲区满时停止
     bool read_once();
     //响应报文写入函数
     bool write();
@@ -90,24 +128,153 @@ public:
         return &m_address;
     }
 
+    //以下供io_uring后端使用，由反应堆完成实际的收发
+    //将收到的数据追加到读缓冲区，缓冲区满返回false
+    bool read_append(const char *data, int len);
+    //读缓冲区的剩余空间，recv不应超过该长度
+    int read_space() const
+    {
+        return READ_BUFFER_SIZE - m_read_idx;
+    }
+    //取得待发送的iovec，count为0表示没有数据待发送
+    struct iovec *write_iov(int &count);
+    //已发送len字节，返回是否还有数据待发送
+    bool write_advance(int len);
+    //本批响应发送完毕，长连接清空发送缓冲区、把未处理的数据移到读缓冲区开头并返回true，短连接返回false
+    bool write_done();
+    //本批响应发送完后是否保持连接
+    bool linger() const
+    {
+        return m_keep_alive;
+    }
+    //长连接在等待下一个请求，读缓冲区为空，没有正在处理或发送的请求
+    bool idle() const
+    {
+        return m_read_idx == 0;
+    }
+    //读缓冲区中还有未处理的数据(流水线发来的后续请求)
+    //响应发送完后为true时反应堆直接把连接交给线程池，不再等待读事件
+    bool pipelined() const
+    {
+        return m_start_line < m_read_idx;
+    }
+    //本批响应还没有发送完
+    bool writing() const
+    {
+        return !m_out.empty() || m_send_fd >= 0;
+    }
+    //本批最后一个响应的文件还有未发送的部分，在write_iov中的数据发送完之后发送
+    bool file_pending() const
+    {
+        return m_send_fd >= 0 && m_send_off < m_send_end;
+    }
+    //用sendfile从上次的位置继续发送文件，返回值同sendfile
+    int send_file();
+
+    //过载时拒绝请求：写入预先生成的503响应(带Retry-After)，发送后关闭连接
+    //反应堆在请求入队失败时调用，线程池在请求排队过久时调用
+    void reject();
+    //读缓冲区中的请求是否需要查询数据库(登录、注册的POST请求)，只看请求行，在入队前由反应堆调用
+    //线程池据此把它放进低优先级队列，限制其并发，避免数据库请求占满工作线程
+    bool db_request() const;
+    //请求进入线程池队列的时间，单调时钟纳秒，用于计算排队时间
+    void set_enqueue_time(long long ns)
+    {
+        m_enqueue_ns = ns;
+    }
+    long long enqueue_time() const
+    {
+        return m_enqueue_ns;
+    }
+    //连接已交给线程池，工作线程还没有调用rearm交还；反应堆在dispatch中调用
+    //此时关闭连接会释放工作线程正在使用的文件缓存条目、发送缓冲区和文件映射，反应堆的超时关闭须推迟
+    void set_busy()
+    {
+        __atomic_add_fetch(&m_busy, 1, __ATOMIC_RELAXED);
+    }
+    bool busy() const
+    {
+        return __atomic_load_n(&m_busy, __ATOMIC_ACQUIRE) != 0;
+    }
+
     //同步线程初始化数据库读取表
-    void initmysql_result();
+    static void initmysql_result();
+    //初始化网站根目录的文件缓存，capacity为最多缓存的条目数，0为不缓存
+    static void init_file_cache(int capacity);
+    //按路径前缀的缓存策略，格式为"前缀=策略,..."，策略为max-age的秒数、no-cache或no-store，最长的前缀优先
+    //如"/ayanami.PNG=86400,/=no-cache"；NULL或空串为不发送Cache-Control；格式错误返回false
+    static bool init_cache_policy(const char *spec);
+    //注册路由：首页、页面跳转和登录、注册，启动时调用一次
+    static void init_routes();
+    //路由的处理函数，arg为注册时给出的参数
+    typedef HTTP_CODE (http_conn::*route_handler)(const char *arg);
+
+    //已知请求头(HEADER_ID)的值，指向读缓冲区中以\0结尾的字符串，不拷贝；请求中没有该头部时返回NULL
+    // len非空时写入值的长度
+    const char *header(int id, int *len = NULL) const
+    {
+        if (!m_known[id].value)
+            return NULL;
+        if (len)
+            *len = m_known[id].value_len;
+        return m_read_buf + m_known[id].value;
+    }
+    //按名称查找任意请求头，不区分大小写；已知头部O(1)，其余在本请求的头部列表中顺序查找
+    const char *find_header(const char *name, int *len = NULL) const;
 
 private:
     void init();
+    //重置单个请求的解析状态，不改变缓冲区
+    void init_request();
+    //当前请求的响应已生成，解析位置移到下一个请求的开头
+    void finish_request();
+    //发送完一批响应后，为处理下一批做准备
+    void next_batch();
+    //释放当前请求的文件缓存条目
+    void unmap_file();
+    //当前文件条目预先生成的200响应，按m_linger选择长、短连接的版本，生成失败返回NULL
+    const file_buf *prerendered();
+    //按Accept-Encoding选择可压缩文件的表示：预压缩的.br、.gz文件，其次即时压缩的gzip
+    void select_encoding();
+    //使用m_real_file加上suffix的预压缩文件，不存在或比原文件旧时返回false
+    bool use_precompressed(CONTENT_ENCODING enc, const char *suffix);
+    //当前文件条目即时压缩的gzip内容，第一次使用时压缩，之后所有连接共享
+    const file_buf *gzip_body();
+    //按If-None-Match(优先)或If-Modified-Since判断客户端缓存的文件是否仍然有效
+    bool not_modified() const;
+    //实体标签(不含引号)与当前表示的ETag是否相同
+    bool etag_equal(const char *tag, int len) const;
+    //没有If-Range，或If-Range与当前的验证器一致(实体标签按强比较，日期须与Last-Modified完全相同)
+    bool if_range() const;
+    //解析Range，区间按起始位置排序、合并后存入m_ranges，返回区间个数；0表示都不可满足
+    //不是bytes单位、格式有误或区间过多时返回-1，忽略Range
+    int parse_range(const char *value);
+    //生成206响应的消息头，各区间的数据引用文件映射，多区间的段头与之交替追加
+    bool add_ranges();
+    //响应是否需要带Expires(HTTP/1.0请求且缓存策略为max-age)，这样的响应与时间有关，不预先生成
+    bool expires() const;
     //从m_read_buf读取，并处理请求报文
     HTTP_CODE process_read();
-    //向m_write_buf写入响应报文数据
+    //向发送缓冲区追加响应报文
     bool process_write(HTTP_CODE ret);
 
     //主状态机解析报文中的请求行数据
     HTTP_CODE parse_request_line(char *text);
     //主状态机解析报文中的请求头数据
     HTTP_CODE parse_headers(char *text);
-    //主状态机解析报文中的请求内容
-    HTTP_CODE parse_content(char *text);
-    //生成响应报文
+    //主状态机解析报文中的请求内容：处理读缓冲区中已收到的消息体，交给consume_body后从缓冲区移除
+    //消息体不在读缓冲区中累积，任意长度的Content-Length和chunked消息体只占用固定的内存
+    HTTP_CODE parse_content();
+    //消息体的处理函数，按到达顺序每次收到一段：登录、注册请求存入表单缓冲区，其余丢弃
+    void consume_body(const char *data, int len);
+    //生成响应报文：按路由表分派，没有注册的路径为静态文件
     HTTP_CODE do_request();
+    //路由的处理函数：网站根目录下的文件path(以/开头)，登录，注册
+    HTTP_CODE serve_file(const char *path);
+    HTTP_CODE serve_login(const char *);
+    HTTP_CODE serve_register(const char *);
+    //从表单中取出用户名和密码，name、password至少FORM_SIZE字节；格式有误返回false
+    bool parse_form(char *name, char *password);
 
     // m_start_line是已经解析的字符，get_line用于将指针向后偏移，指向未处理的字符
     char *get_line()
@@ -116,23 +283,34 @@ private:
     };
     //从状态机读取一行，分析是请求报文的哪一部分
     LINE_STATUS parse_line();
+    //释放本批所有响应引用的文件缓存条目，清空发送缓冲区
     void unmap();
+    //重新注册连接上的事件，epoll后端为modfd，io_uring后端通知所属反应堆
+    void rearm(int ev);
 
     //根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
-    bool add_response(const char *format, ...);
+    //均为直接拷贝预先序列化的片段，不经过格式化；内存不足时返回false
+    bool add_bytes(const char *data, int len);
+    bool add_number(unsigned long long value);
     bool add_content(const char *content);
-    bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    //只支持本服务器会发出的200、206、304、416，错误响应使用启动时生成的完整报文
+    bool add_status_line(int status);
+    bool add_headers(long long content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_encoding();
+    bool add_vary();
+    bool add_cache_headers();
+    bool add_accept_ranges();
+    bool add_content_length(long long content_length);
+    bool add_content_range(long long first, long long last, long long size);
     bool add_linger();
     bool add_blank_line();
 
-public:
-    static int m_epollfd;
-    static int m_user_count;
-
 private:
+    //所属反应堆的epoll句柄
+    int m_epollfd;
+    //所属反应堆，仅io_uring后端非空
+    reactor *m_reactor;
     // 传输socket
     int m_sockfd;
     sockaddr_in m_address;
@@ -146,10 +324,22 @@ private:
     // m_read_buf中已经解析的字符个数
     int m_start_line;
 
-    //存储发出的响应报文数据
-    char m_write_buf[WRITE_BUFFER_SIZE];
-    //指示buffer中的长度
-    int m_write_idx;
+    //请求头在m_read_buf中的位置和长度，只在当前请求内有效；值的位置为0表示没有该头部
+    struct header_field
+    {
+        unsigned short name;
+        unsigned short name_len;
+        unsigned short value;
+        unsigned short value_len;
+    };
+    //按HEADER_ID索引的已知头部
+    header_field m_known[HDR_COUNT];
+    //按出现顺序的全部头部
+    header_field m_headers[MAX_HEADERS];
+    int m_header_count;
+
+    //本批响应的发送缓冲区：生成的报文拷入池中的段，文件映射等只引用，按顺序组成iovec
+    response_buffer m_out;
 
     //主状态机的状态
     CHECK_STATE m_check_state;
@@ -162,14 +352,56 @@ private:
     char *m_url;
     char *m_version;
     char *m_host;
-    int m_content_length;
-    bool m_linger;        //长短连接
+    long long m_content_length;
+    // Transfer-Encoding: chunked
+    bool m_chunked;
+    BODY_STATE m_body_state;
+    long long m_body_left;
+    //登录、注册表单，m_string指向它
+    char m_form[FORM_SIZE + 1];
+    int m_form_len;
+    bool m_form_overflow;
+    bool m_linger;        //长短连接，HTTP/1.1默认为长连接，HTTP/1.0需要Connection: keep-alive
     char *m_file_address; //读取服务器上的文件地址
+    //本次响应的文件信息，压缩发送时st_size为压缩后的长度
     struct stat m_file_stat;
-    struct iovec m_iv[2]; // io向量机制iovec
-    int m_iv_count;
+    //响应的Content-Type，NULL为不发送
+    const char *m_content_type;
+    //响应的内容编码，可压缩的文件带Vary: Accept-Encoding
+    CONTENT_ENCODING m_encoding;
+    bool m_vary;
+    //响应带ETag、Last-Modified(取自m_file)和缓存策略m_policy(NULL为没有)
+    bool m_cache_headers;
+    const cache_policy *m_policy;
+    //请求的字节区间，闭区间
+    struct byte_range
+    {
+        off_t first;
+        off_t last;
+    };
+    byte_range m_ranges[MAX_RANGES];
+    int m_range_count;
+    //多区间响应为大文件临时建立的映射，NULL为没有；这样的响应总是本批最后一个响应，发送完后解除
+    char *m_range_map;
+    off_t m_range_map_len;
+    //当前请求的文件缓存条目，NULL为没有
+    file_entry *m_file;
+    //本批响应引用的文件缓存条目，发送完后释放
+    file_entry *m_files[MAX_PIPELINE];
+    int m_file_count;
+    //本批用sendfile发送的文件(属于m_files中的条目)及发送位置，它总是本批最后一个响应
+    int m_send_fd;
+    off_t m_send_off;
+    off_t m_send_end;
+    //当前请求在m_read_buf中的起始位置，之前的数据已经处理完
+    int m_req_start;
+    //本批最后一个响应是否保持连接
+    bool m_keep_alive;
+    //该连接已处理的请求数及上限
+    int m_requests;
+    int m_max_requests;
     int cgi;             //是否启用的POST
     char *m_string;      //存储请求数据
-    int bytes_to_send;   //剩余发送字节数
-    int bytes_have_send; //已发送字节数
+    long long m_enqueue_ns; //进入线程池队列的时间
+    int m_busy;             //已交给线程池、尚未交还的次数，计数而不是标志：交还后反应堆可能在工作线程返回前再次交出
 };
\ No newline at end of file
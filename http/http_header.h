@@ -0,0 +1,133 @@
+#pragma once
+#include <strings.h>
+
+//已知请求头的编号，http_conn按编号保存其值在读缓冲区中的位置
+enum HEADER_ID
+{
+    HDR_CONNECTION = 0,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_HOST,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_USER_AGENT,
+    HDR_COOKIE,
+    HDR_REFERER,
+    HDR_CACHE_CONTROL,
+    HDR_AUTHORIZATION,
+    HDR_EXPECT,
+    HDR_TRANSFER_ENCODING,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_COUNT
+};
+
+//与HEADER_ID顺序一致，小写
+static constexpr const char *header_names[HDR_COUNT] = {
+    "connection",
+    "content-length",
+    "content-type",
+    "host",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "user-agent",
+    "cookie",
+    "referer",
+    "cache-control",
+    "authorization",
+    "expect",
+    "transfer-encoding",
+    "if-none-match",
+    "if-modified-since",
+    "range",
+    "if-range",
+};
+
+//哈希表大小，2的幂
+#define HEADER_HASH_SIZE 64
+
+//头部名称只含字母、数字和'-'，或上0x20即转为小写，对'-'和数字没有影响
+constexpr unsigned header_lower(char c)
+{
+    return (unsigned char)c | 0x20;
+}
+
+//取长度和首、中、尾三个字符，由seed混合，编译期选出对已知头部没有冲突的seed
+constexpr unsigned header_hash(const char *name, int len, unsigned seed)
+{
+    return ((((unsigned)len * seed ^ header_lower(name[0])) * seed ^ header_lower(name[len / 2])) * seed ^ header_lower(name[len - 1])) & (HEADER_HASH_SIZE - 1);
+}
+
+constexpr int header_name_len(const char *name)
+{
+    int len = 0;
+    while (name[len])
+        ++len;
+    return len;
+}
+
+constexpr bool header_seed_ok(unsigned seed)
+{
+    bool used[HEADER_HASH_SIZE] = {};
+    for (int i = 0; i < HDR_COUNT; ++i)
+    {
+        unsigned h = header_hash(header_names[i], header_name_len(header_names[i]), seed);
+        if (used[h])
+            return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+constexpr unsigned header_find_seed()
+{
+    for (unsigned seed = 1; seed < 100000; ++seed)
+    {
+        if (header_seed_ok(seed))
+            return seed;
+    }
+    return 0;
+}
+
+static constexpr unsigned HEADER_SEED = header_find_seed();
+static_assert(HEADER_SEED != 0, "no perfect hash seed for the known headers");
+
+//哈希值到头部编号的表，空位为-1
+struct header_table
+{
+    signed char id[HEADER_HASH_SIZE];
+    signed char len[HEADER_HASH_SIZE];
+};
+
+constexpr header_table header_make_table()
+{
+    header_table t = {};
+    for (int i = 0; i < HEADER_HASH_SIZE; ++i)
+        t.id[i] = -1;
+    for (int i = 0; i < HDR_COUNT; ++i)
+    {
+        int len = header_name_len(header_names[i]);
+        unsigned h = header_hash(header_names[i], len, HEADER_SEED);
+        t.id[h] = i;
+        t.len[h] = len;
+    }
+    return t;
+}
+
+static constexpr header_table HEADER_TABLE = header_make_table();
+
+//按名称查找已知头部，不区分大小写，O(1)：一次哈希、一次长度比较和一次strncasecmp；未知头部返回-1
+inline int header_lookup(const char *name, int len)
+{
+    if (len <= 0)
+        return -1;
+    unsigned h = header_hash(name, len, HEADER_SEED);
+    int id = HEADER_TABLE.id[h];
+    if (id < 0 || HEADER_TABLE.len[h] != len || strncasecmp(name, header_names[id], len) != 0)
+        return -1;
+    return id;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string.h>
+#include <string>
+#include <vector>
+
+//按请求方法和完整路径查找处理函数的路由表，启动时注册，之后只读，多个线程可以同时查找
+//开放寻址的哈希表，查找为一次O(路径长度)的哈希和长度、内容比较，不分配内存
+// H为处理函数的类型，由使用者决定(如成员函数指针)
+template <class H>
+class route_table
+{
+public:
+    struct route
+    {
+        //可匹配的请求方法的位掩码，第i位对应方法编号i
+        unsigned methods;
+        std::string path;
+        H handler;
+        //注册时给出的参数，原样交给处理函数
+        const char *arg;
+        //处理时会阻塞(查询数据库)，线程池把这样的请求放进低优先级队列
+        bool blocking;
+    };
+
+    route_table() : m_mask(0) {}
+
+    //注册路由，同一路径的不同方法可以分别注册
+    void add(unsigned methods, const char *path, H handler, const char *arg = NULL, bool blocking = false)
+    {
+        route r;
+        r.methods = methods;
+        r.path = path;
+        r.handler = handler;
+        r.arg = arg;
+        r.blocking = blocking;
+        m_routes.push_back(r);
+        rebuild();
+    }
+
+    //查找method(方法编号)和path[0, len)对应的路由，没有则返回NULL
+    const route *find(int method, const char *path, int len) const
+    {
+        if (m_routes.empty())
+            return NULL;
+        for (unsigned i = hash(path, len) & m_mask;; i = (i + 1) & m_mask)
+        {
+            int idx = m_slots[i];
+            if (idx < 0)
+                return NULL;
+            const route &r = m_routes[idx];
+            if ((int)r.path.size() == len && (r.methods & (1u << method)) && memcmp(r.path.data(), path, len) == 0)
+                return &r;
+        }
+    }
+
+private:
+    // FNV-1a
+    static unsigned hash(const char *path, int len)
+    {
+        unsigned h = 2166136261u;
+        for (int i = 0; i < len; ++i)
+            h = (h ^ (unsigned char)path[i]) * 16777619u;
+        return h;
+    }
+
+    //槽位数为2的幂且不少于路由数的两倍，保证总有空位结束查找
+    void rebuild()
+    {
+        unsigned size = 8;
+        while (size < 2 * m_routes.size())
+            size <<= 1;
+        m_mask = size - 1;
+        m_slots.assign(size, -1);
+        for (size_t k = 0; k < m_routes.size(); ++k)
+        {
+            unsigned i = hash(m_routes[k].path.data(), m_routes[k].path.size()) & m_mask;
+            while (m_slots[i] >= 0)
+                i = (i + 1) & m_mask;
+            m_slots[i] = k;
+        }
+    }
+
+private:
+    std::vector<route> m_routes;
+    std::vector<int> m_slots;
+    unsigned m_mask;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//请求报文的字符扫描，一次比较16(SSE2)或32(AVX2)个字节，按编译目标选择，其他平台逐字节扫描
+//只读取[begin, end)内的字节，不会越过已接收数据的末尾；调用者记录返回的位置，数据不完整时下次从该位置继续
+
+//在buf[begin, end)中查找第一个a或b，返回其下标，没有则返回end
+inline int scan_either(const char *buf, int begin, int end, char a, char b)
+{
+    int i = begin;
+#if defined(__AVX2__)
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i xa = _mm_set1_epi8(a);
+    const __m128i xb = _mm_set1_epi8(b);
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, xa), _mm_cmpeq_epi8(chunk, xb)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    //不足一个向量的尾部逐字节比较
+    for (; i < end; ++i)
+    {
+        if (buf[i] == a || buf[i] == b)
+            return i;
+    }
+    return end;
+}
+
+//行结束符\r或\n的位置
+inline int scan_line_end(const char *buf, int begin, int end)
+{
+    return scan_either(buf, begin, end, '\r', '\n');
+}
+
+//请求行中分隔方法、url和版本号的空格或\t的位置，没有则返回NULL
+inline char *scan_token_end(char *begin, char *end)
+{
+    int i = scan_either(begin, 0, (int)(end - begin), ' ', '\t');
+    return begin + i == end ? NULL : begin + i;
+}
+
+//跳过空格和\t，返回第一个其他字符的位置
+inline char *skip_blank(char *p, char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+    return p;
+}
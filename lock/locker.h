@@ -2,6 +2,10 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 //信号量
 class sem
@@ -103,4 +107,61 @@ public:
 private:
     pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
-};
\ No newline at end of file
+};
+
+//自旋等待时让出流水线，减少对同核超线程的干扰
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+//基于futex的事件计数，用于无锁队列的等待与唤醒
+//等待方：key = prepare_wait()，再检查一次条件，条件满足则cancel_wait，否则commit_wait(key)
+//通知方：先使条件成立，再notify；没有等待者时notify不进入内核
+class eventcount
+{
+public:
+    eventcount() : m_seq(0), m_waiters(0) {}
+
+    unsigned prepare_wait()
+    {
+        unsigned key = __atomic_load_n(&m_seq, __ATOMIC_ACQUIRE);
+        //与notify中的读m_waiters构成全序，二者至少有一方看到对方的修改
+        __atomic_fetch_add(&m_waiters, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        return key;
+    }
+    void cancel_wait()
+    {
+        __atomic_fetch_sub(&m_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    //m_seq在prepare_wait之后已改变时立即返回
+    void commit_wait(unsigned key)
+    {
+        syscall(SYS_futex, &m_seq, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+        __atomic_fetch_sub(&m_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    //没有等待者时返回false
+    bool notify_one() { return notify(1); }
+    bool notify_all() { return notify(INT_MAX); }
+
+private:
+    bool notify(int n)
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_waiters, __ATOMIC_SEQ_CST) == 0)
+            return false;
+        __atomic_fetch_add(&m_seq, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &m_seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+        return true;
+    }
+
+private:
+    unsigned m_seq;
+    int m_waiters;
+};
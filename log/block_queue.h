@@ -22,6 +22,7 @@ public:
         m_size = 0;
         m_front = -1;
         m_back = -1;
+        m_closed = false;
 
         //创建互斥锁和条件变量
         m_mutex = new pthread_mutex_t;
@@ -39,6 +40,15 @@ public:
         pthread_mutex_unlock(m_mutex);
     }
 
+    //关闭队列，唤醒所有等待的消费者；之后pop取完剩余元素即返回false
+    void close()
+    {
+        pthread_mutex_lock(m_mutex);
+        m_closed = true;
+        pthread_cond_broadcast(m_cond);
+        pthread_mutex_unlock(m_mutex);
+    }
+
     ~block_queue()
     {
         pthread_mutex_lock(m_mutex);
@@ -156,6 +166,12 @@ public:
         //??
         while (m_size <= 0)
         {
+            //队列已关闭且取空
+            if (m_closed)
+            {
+                pthread_mutex_unlock(m_mutex);
+                return false;
+            }
             //当重新抢到互斥锁，pthread_cond_wait返回为0
             if (0 != pthread_cond_wait(m_cond, m_mutex))
             {
@@ -180,4 +196,5 @@ private:
     int m_max_size;
     int m_front;
     int m_back;
+    bool m_closed;
 };
\ No newline at end of file
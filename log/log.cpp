@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include "log.h"
 #include <pthread.h>
+#include <sched.h>
 using namespace std;
 
 //默认构造函数，创建互斥锁，初始化是否同步标志位
@@ -30,7 +31,7 @@ Log::~Log()
 }
 
 //异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size)
+bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size, int cpu)
 {
     //如果设置了max_queue_size,则设置为异步
     if (max_queue_size >= 1)
@@ -40,10 +41,21 @@ bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max
 
         //创建并设置阻塞队列长度
         m_log_queue = new block_queue<string>(max_queue_size);
-        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+
+        //绑定写日志线程的CPU，不与反应堆、工作线程争用
+        if (cpu >= 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
 
         // flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        pthread_create(&m_tid, &attr, flush_log_thread, NULL);
+        pthread_attr_destroy(&attr);
     }
 
     //输出内容的长度
@@ -201,4 +213,15 @@ void Log::flush(void)
     //强制刷新写入流缓冲区
     fflush(m_fp);
     pthread_mutex_unlock(m_mutex);
-}
\ No newline at end of file
+}
+void Log::shutdown(void)
+{
+    if (m_is_async)
+    {
+        //关闭队列后写日志线程写完剩余的日志即退出
+        m_log_queue->close();
+        pthread_join(m_tid, NULL);
+        m_is_async = false;
+    }
+    flush();
+}
@@ -25,7 +25,8 @@ public:
     }
 
     //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    // cpu为异步写日志线程绑定的CPU，-1为不绑定
+    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0, int cpu = -1);
 
     //将输出内容按照标准格式整理
     void write_log(int level, const char *format, ...);
@@ -33,6 +34,9 @@ public:
     //强制刷新缓冲区
     void flush(void);
 
+    //退出前调用：异步模式下写完队列中剩余的日志并回收写日志线程，之后的日志同步写入
+    void shutdown(void);
+
 private:
     Log();
     virtual ~Log();
@@ -63,6 +67,7 @@ private:
     char *m_buf;                      //要输出的内容
     block_queue<string> *m_log_queue; //阻塞队列
     bool m_is_async;                  //是否同步标志位
+    pthread_t m_tid;                  //异步写日志线程
     // locker m_mutex;                   //同步类
 };
 
@@ -1,111 +1,25 @@
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <sys/epoll.h>
 #include <string.h>
 #include <stdlib.h>
 #include <iostream>
 
+#include "./config.h"
 #include "./lock/locker.h"
 #include "./threadpool/threadpool.h"
 #include "./CGImysql/sql_connection_pool.h"
-#include "./timer/lst_timer.h"
 #include "./http/http_conn.h"
+#include "./reactor/reactor.h"
 #include "./log/log.h"
 
-#define MAX_FD 65536           //最大文件描述符
-#define MAX_EVENT_NUMBER 10000 //最大事件数
-#define TIMESLOT 5             //最小超时单位
-
-//这三个函数在http_conn.cpp中定义，改变链接属性
-extern int addfd(int epollfd, int fd, bool one_shot);
-extern int setnonblocking(int fd);
-
-//设置定时器相关参数
-static int pipefd[2];
-static sort_timer_lst timer_lst;
-static int epollfd = 0;
-
-//信号处理函数
-void sig_handler(int sig)
-{
-    printf("%s\n", "alarm信号处理");
-
-    //为保证函数的可重入性，保留原来的errno
-    //可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据
-    int save_errno = errno;
-    int msg = sig;
-
-    //将信号值从管道写端写入，传输字符类型，而非整型
-    send(pipefd[1], (char *)&msg, 1, 0);
-
-    //将原来的errno赋值为当前的errno
-    errno = save_errno;
-}
-
-void show_error(int connfd, const char *info)
-{
-    // printf("%s", info);
-    send(connfd, info, strlen(info), 0);
-    close(connfd);
-}
-
-//设置信号的处理函数
-void addsig(int sig, void(handler)(int), bool restart = true)
-{
-    //创建sigaction结构体变量
-    struct sigaction sa;
-    memset(&sa, '\0', sizeof(sa));
-
-    //信号处理函数中仅仅发送信号值，不做对应逻辑处理
-    sa.sa_handler = handler;
-    //使被信号打断的系统调用自动重新发起
-    if (restart)
-        sa.sa_flags |= SA_RESTART;
-
-    //将所有信号添加到信号集中
-    sigfillset(&sa.sa_mask);
-
-    //执行sigaction函数（操作的信号，对信号设置新的处理方式）
-    assert(sigaction(sig, &sa, NULL) != -1);
-}
-
-//定时处理任务，重新定时以不断触发SIGALRM信号
-void timer_handler()
+int main(int argc, char *argv[])
 {
-    timer_lst.tick();
-    alarm(TIMESLOT);
-}
-
-//定时器回调函数
-void cb_func(client_data *user_data)
-{
-    //删除非活动连接在socket上的注册事件，并关闭
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert(user_data);
-    // printf("%s%d\n", "超时, 关闭socket: ", user_data->sockfd);
-    close(user_data->sockfd);
-
-    LOG_INFO("close fd %d", user_data->sockfd);
-    Log::get_instance()->flush();
-}
+    //命令行解析
+    Config config;
+    config.parse_arg(argc, argv);
 
-//设置信号为LT阻塞模式
-void addfd_lt(int epollfd, int fd, bool one_shot)
-{
-    epoll_event event;
-    event.data.fd = fd;
-    event.events = EPOLLIN | EPOLLRDHUP;
-    if (one_shot)
-        event.events |= EPOLLONESHOT;
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-}
-
-// int main(int argc, char *argv[])
-int main()
-{
-    Log::get_instance()->init("./mylog.log", 8192, 2000000, 10); //异步日志模型
+    //屏蔽SIGTERM和SIGUSR1，之后创建的日志线程、线程池和反应堆线程都继承该掩码，信号由0号反应堆的signalfd读出
+    block_signals();
 
-    int port = 8001;
+    Log::get_instance()->init("./mylog.log", 8192, 2000000, 10, config.LOG_CPU); //异步日志模型
 
     //忽略SIGPIPE信号
     addsig(SIGPIPE, SIG_IGN);
@@ -114,7 +28,7 @@ int main()
     threadpool<http_conn> *pool = NULL;
     try
     {
-        pool = new threadpool<http_conn>;
+        pool = new threadpool<http_conn>(config.THREAD_MIN, 10000, config.WORK_STEALING != 0, config.THREAD_MAX, config.WORKER_CPUS, config.DB_PCT);
     }
     catch (const std::exception &e)
     {
@@ -125,292 +39,112 @@ int main()
     //创建数据库连接池
     connection_pool *connPool = connection_pool::GetInstance("localhost", "root", "1234", "myserver", 3306, 5);
 
-    // http_conn数组；用户
-    http_conn *users = new http_conn[MAX_FD];
-    assert(users);
-
     //初始化数据库读取表
-    users->initmysql_result();
-
-    /**
-     * @brief 创建监听socket文件描述符
-     *     协议族为domain、协议类型为type、协议编号为protocol
-     *     IPv4 Internet协议，TCP连接，协议中只有一种特定类型
-     */
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd >= 0);
-
-    int ret = 0;
-    /* 创建监听socket的TCP/IP的IPV4 socket地址 */
-    struct sockaddr_in address;
-    bzero(&address, sizeof(address));
-
-    address.sin_family = AF_INET; //指定IP地址地址版本为IPV4
-    // htonl：本机字节顺序转化为网络字节顺序，INADDR_ANY：将套接字绑定到所有IP,s_addr: int
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(port);
-
-    int flag = 1;
-    /**
-     * @brief Construct a new setsockopt object
-     * SOL_SOCKET,基本套接口
-     * SO_REUSEADDR 允许端口被重复使用,flag=1
-     */
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
-    /* 绑定socket和它的地址 */
-    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
-    assert(ret >= 0);
-    /* 创建监听队列以存放待处理的客户连接，在这些客户连接被accept()之前 ,5个*/
-    ret = listen(listenfd, 5);
-    assert(ret >= 0);
-
-    /* 用于存储epoll事件表中就绪事件的event数组 */
-    epoll_event events[MAX_EVENT_NUMBER];
-    /* 创建一个额外的文件描述符来唯一标识内核中的epoll事件表 */
-    int epollfd = epoll_create(5);
-    assert(epollfd != -1);
-    /* 主线程往epoll内核事件表中注册监听socket事件，当listen到新的客户连接时，listenfd变为就绪事件 */
-    // listenfd需要水平触发
-    addfd_lt(epollfd, listenfd, false);
-    //将上述epollfd赋值给http类的m_epollfd属性
-    http_conn::m_epollfd = epollfd;
-
-    //创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-
-    //设置管道写端为非阻塞
-    setnonblocking(pipefd[1]);
-    //设置管道读端为ET非阻塞
-    addfd(epollfd, pipefd[0], false);
-
-    //传递给主循环的信号值，这里只关注SIGALRM和SIGTERM
-    //由alarm或settimer设置的实施闹钟引起；终止进程
-    addsig(SIGALRM, sig_handler, false);
-    addsig(SIGTERM, sig_handler, false);
+    http_conn::initmysql_result();
 
-    client_data *users_timer = new client_data[MAX_FD];
+    //路由表，之后只读
+    http_conn::init_routes();
 
-    //超时标志
-    bool timeout = false;
-
-    //每隔TIMESLOT时间触发SIGALRM信号
-    alarm(TIMESLOT);
-
-    printf("%s", "服务器启动......\n");
+    //静态文件缓存，inotify监听网站根目录使变化的文件失效
+    http_conn::init_file_cache(config.FILE_CACHE);
+    if (!http_conn::init_cache_policy(config.CACHE_POLICY))
+    {
+        std::cerr << "invalid cache policy: " << config.CACHE_POLICY << '\n';
+        return 1;
+    }
 
-    bool stop_server = false;
-    while (!stop_server)
+    //创建反应堆，多于一个时以SO_REUSEPORT各自监听同一端口，连接表按反应堆均分
+    int reactor_num = config.REACTOR_NUM;
+    bool reuseport = reactor_num > 1;
+    bool use_uring = config.IO_URING != 0;
+#ifndef WITH_IO_URING
+    if (use_uring)
     {
-        // printf("%s", "epoll_wait等待中...\n");
+        std::cerr << "built without WITH_IO_URING, using epoll" << '\n';
+        use_uring = false;
+    }
+#endif
+    reactor **reactors = new reactor *[reactor_num];
+    for (int i = 0; i < reactor_num; ++i)
+    {
+        int cpu = config.REACTOR_CPUS.empty() ? -1 : config.REACTOR_CPUS[i % config.REACTOR_CPUS.size()];
+        reactors[i] = new reactor(i, config.PORT, reuseport, MAX_FD / reactor_num, config.TIMER_MS, pool, use_uring, cpu);
+        reactors[i]->set_keepalive(config.KEEPALIVE_MS, config.MAX_REQUESTS);
+        if (reactors[i]->init())
+            continue;
 
-        /* 主线程调用epoll_wait等待一组文件描述符上的事件，并将当前所有就绪的epoll_event复制到events数组中 */
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if (number < 0 && errno != EINTR)
+        if (use_uring)
         {
-            LOG_ERROR("%s", "epoll failure");
-            Log::get_instance()->flush();
-            break;
+            //内核不支持所需的io_uring特性，全部反应堆回退到epoll
+            std::cerr << "io_uring init failed, using epoll" << '\n';
+            use_uring = false;
+            for (int j = 0; j <= i; ++j)
+                delete reactors[j];
+            i = -1;
+            continue;
         }
+        std::cerr << "reactor " << i << " init failed, errno is " << errno << '\n';
+        return 1;
+    }
 
-        // printf("%s%d\n", "epoll_wait取得事件数: ", number);
+    // 0号反应堆在主线程运行，负责处理信号，收到SIGTERM时所有反应堆一起排空
+    if (!reactors[0]->init_signal(reactors, reactor_num, config.DRAIN_MS))
+    {
+        std::cerr << "signalfd init failed" << '\n';
+        return 1;
+    }
 
-        /* 遍历这一数组以处理这些已经就绪的事件 */
-        for (int i = 0; i < number; ++i)
+    //其余反应堆各自一个线程
+    pthread_t *tids = new pthread_t[reactor_num];
+    for (int i = 1; i < reactor_num; ++i)
+    {
+        if (pthread_create(tids + i, NULL, reactor::worker, reactors[i]) != 0)
         {
-            int sockfd = events[i].data.fd; // 事件表中就绪的socket文件描述符
-
-            //处理新到的客户连接
-            if (sockfd == listenfd)
-            {
-                // 当listen到新的用户连接，listenfd上则产生就绪事件
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-
-                int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlength); //新socket
-
-                // printf("%s%d\n", "产生了传输socket: ", connfd);
-
-                if (connfd < 0)
-                {
-                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                    Log::get_instance()->flush();
-                    continue;
-                }
-                if (http_conn::m_user_count >= MAX_FD)
-                {
-                    show_error(connfd, "Internal server is busy");
-                    LOG_ERROR("%s", "Internal server busy");
-                    Log::get_instance()->flush();
-                    continue;
-                }
-                // http与socket一一对应，将新的socket加入epoll，应对后面的传输
-                users[connfd].init(connfd, client_address);
-
-                //初始化该连接对应的连接资源
-                users_timer[connfd].address = client_address;
-                users_timer[connfd].sockfd = connfd;
-
-                //创建定时器临时变量
-                util_timer *timer = new util_timer();
-                //设置定时器对应的连接资源
-                timer->user_data = &users_timer[connfd];
-                //设置回调函数
-                timer->cb_func = cb_func;
-
-                time_t cur = time(NULL);
-                timer->expire = cur + 3 * TIMESLOT;
-                //创建该连接对应的定时器，初始化为前述临时变量
-                users_timer[connfd].timer = timer;
-                //将该定时器添加到链表中
-                timer_lst.add_timer(timer);
-            }
-            //处理异常事件
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
-            {
-                // printf("%s\n", "异常事件！");
-
-                //重复关闭？
-                users[sockfd].close_conn();
-
-                // 服务器关闭连接，移除对应的定时器
-                cb_func(&users_timer[sockfd]);
-                util_timer *timer = users_timer[sockfd].timer;
-                if (timer)
-                {
-                    timer_lst.del_timer(timer);
-                }
-            }
-            //管道读端对应文件描述符发生读事件，处理信号
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
-            {
-                // printf("%s\n", "收到信号");
-
-                int sig;
-                char signals[1024];
-
-                //从管道读端读出信号值，成功返回字节数，失败返回-1
-                //正常情况下，这里的ret返回值总是1，只有14和15两个ASCII码对应的字符
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1)
-                {
-                    continue;
-                }
-                else if (ret == 0)
-                {
-                    continue;
-                }
-                else
-                {
-                    for (int i = 0; i < ret; ++i)
-                    {
-                        switch (signals[i])
-                        {
-                        case SIGALRM:
-                        {
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM:
-                        {
-                            stop_server = true;
-                        }
-                        }
-                    }
-                }
-            }
-            //处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN)
-            {
-                // printf("%s\n", "处理客户连接上接收到的数据");
-
-                //创建定时器临时变量，将该连接对应的定时器取出来
-                util_timer *timer = users_timer[sockfd].timer;
-
-                //读入对应缓冲区
-                if (users[sockfd].read_once())
-                {
-                    // printf("%s\n", users[sockfd].m_read_buf);
+            std::cerr << "reactor " << i << " thread create failed" << '\n';
+            return 1;
+        }
+    }
 
-                    LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
+    printf("服务器启动......(%d个反应堆, %s, %d-%d个工作线程)\n", reactor_num, use_uring ? "io_uring" : "epoll", config.THREAD_MIN, config.THREAD_MAX);
 
-                    //处理读入的请求
-                    pool->append(users + sockfd);
+    reactors[0]->loop();
 
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        timer_lst.adjust_timer(timer);
+    //收到SIGTERM时其余反应堆同样在排空，等待它们结束；0号反应堆出错退出时通知其余反应堆立即退出
+    long long deadline = reactors[0]->drain_deadline();
+    for (int i = 1; i < reactor_num; ++i)
+    {
+        if (deadline < 0)
+            reactors[i]->stop();
+        pthread_join(tids[i], NULL);
+    }
 
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                    }
-                }
-                else
-                {
-                    // 服务器关闭连接
-                    users[sockfd].close_conn();
-                    //服务器端关闭连接，移除对应的定时器
-                    cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            }
-            else if (events[i].events & EPOLLOUT)
-            {
-                // printf("%s\n", "处理写事件");
+    //反应堆不再入队，等待线程池处理完剩余的任务后回收工作线程
+    long long left = deadline < 0 ? 0 : deadline - timer_now_ms();
+    bool drained = pool->drain(left > 0 ? (int)left : 0);
 
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].write())
-                {
-                    //若有数据传输，则将定时器往后延迟3个单位
-                    //并对新的定时器在链表上的位置进行调整
-                    // users[sockfd].close_conn();
+    pool_stats stats;
+    pool->get_stats(stats);
+    printf("请求计数: queued %lld, served %lld, rejected %lld, shed %lld\n", stats.queued, stats.served, stats.rejected, stats.shed);
+    long long hits, misses;
+    file_cache::get_instance()->get_stats(hits, misses);
+    printf("文件缓存: hits %lld, misses %lld\n", hits, misses);
+    file_cache::get_instance()->shutdown();
 
-                    if (timer)
-                    {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        timer_lst.adjust_timer(timer);
-                    }
-                }
-                else
-                {
-                    users[sockfd].close_conn();
+    //写完队列中剩余的日志
+    Log::get_instance()->shutdown();
 
-                    //服务器端关闭连接，移除对应的定时器
-                    cb_func(&users_timer[sockfd]);
-                    if (timer)
-                    {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            }
-        }
-        //处理定时器为非必须事件，收到信号并不是立马处理
-        //完成读写事件后，再进行处理
-        if (timeout)
-        {
-            timer_handler();
-            timeout = false;
-        }
+    //仍有工作线程在处理请求时，它们还在使用连接表和线程池，不释放，由进程退出回收
+    if (drained)
+    {
+        for (int i = 0; i < reactor_num; ++i)
+            delete reactors[i];
+        delete pool;
+        //销毁数据库连接池
+        connPool->DestroyPool();
     }
-    close(epollfd);
-    close(listenfd);
-    close(pipefd[1]);
-    close(pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
-    delete pool;
-    //销毁数据库连接池
-    connPool->DestroyPool();
+    delete[] reactors;
+    delete[] tids;
 
     printf("%s\n", "服务器停止运行！");
-    return 0;
-}
\ No newline at end of file
+    return drained ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# 预压缩网站根目录下可压缩的文本文件，生成同名的.gz，有brotli命令时同时生成.br
+# 服务器按Accept-Encoding直接发送这些文件，不再即时压缩；原文件修改后需要重新执行，否则旧的预压缩文件被忽略
+# 用法：sh precompress.sh [网站根目录]，默认为脚本所在目录下的root；也可以在构建目录中执行make precompress
+ROOT=${1:-$(dirname "$0")/root}
+
+find "$ROOT" -type f \( -name '*.html' -o -name '*.htm' -o -name '*.css' -o -name '*.js' -o -name '*.json' \
+    -o -name '*.txt' -o -name '*.xml' -o -name '*.svg' \) | while read -r f; do
+    # 先写临时文件再改名，服务器不会读到写了一半的文件
+    gzip -9 -n -c "$f" > "$f.gz.tmp" && mv -f "$f.gz.tmp" "$f.gz"
+    if command -v brotli > /dev/null 2>&1; then
+        brotli -q 11 -c "$f" > "$f.br.tmp" && mv -f "$f.br.tmp" "$f.br"
+    fi
+done
@@ -0,0 +1,1145 @@
+#include "reactor.h"
+#include "../log/log.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <dirent.h>
+#include <sched.h>
+#include <poll.h>
+#include <limits.h>
+
+//这两个函数在http_conn.cpp中定义，改变链接属性
+extern void addfd(int epollfd, int fd, bool one_shot);
+extern int setnonblocking(int fd);
+
+#ifdef WITH_IO_URING
+// io_uring请求的user_data编码：类型(8位) | 槽位代数(32位) | 槽位(24位)，0为归还缓冲区和取消accept
+enum
+{
+    UD_ACCEPT = 1,
+    UD_RECV,
+    UD_WRITE,
+    UD_SENDFILE,
+    UD_TIMER,
+    UD_WAKEUP,
+    UD_SIGNAL
+};
+#define URING_ENTRIES 4096 //提交队列长度
+#define URING_BUF_COUNT 512 // provided buffer个数
+#define URING_BGID 0        // provided buffer组号
+
+static inline unsigned long long make_ud(int type, int slot, unsigned gen)
+{
+    return ((unsigned long long)type << 56) | ((unsigned long long)gen << 24) | (unsigned long long)slot;
+}
+#endif
+
+//由signalfd接收的信号集合
+static void server_sigset(sigset_t *mask)
+{
+    sigemptyset(mask);
+    sigaddset(mask, SIGTERM);
+    sigaddset(mask, SIGUSR1);
+}
+
+void block_signals()
+{
+    //新线程继承创建者的信号掩码，信号只能通过signalfd读出，不会打断任何线程的系统调用
+    sigset_t mask;
+    server_sigset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+//设置信号的处理函数
+void addsig(int sig, void(handler)(int), bool restart)
+{
+    //创建sigaction结构体变量
+    struct sigaction sa;
+    memset(&sa, '\0', sizeof(sa));
+
+    //信号处理函数中仅仅发送信号值，不做对应逻辑处理
+    sa.sa_handler = handler;
+    //使被信号打断的系统调用自动重新发起
+    if (restart)
+        sa.sa_flags |= SA_RESTART;
+
+    //将所有信号添加到信号集中
+    sigfillset(&sa.sa_mask);
+
+    //执行sigaction函数（操作的信号，对信号设置新的处理方式）
+    assert(sigaction(sig, &sa, NULL) != -1);
+}
+
+static void show_error(int connfd, const char *info)
+{
+    send(connfd, info, strlen(info), 0);
+    close(connfd);
+}
+
+//设置监听socket为LT模式
+static void addfd_lt(int epollfd, int fd, bool one_shot)
+{
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    if (one_shot)
+        event.events |= EPOLLONESHOT;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// CPU所在的NUMA结点，没有NUMA信息时返回-1
+static int cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir)
+        return -1;
+
+    int node = -1;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (sscanf(ent->d_name, "node%d", &node) == 1)
+            break;
+    }
+    closedir(dir);
+    return node;
+}
+
+//让一段内存优先使用node上的物理页
+//已分配的页迁移过去，尚未访问的页之后无论由哪个线程(反应堆或工作线程)首次访问，都在该结点上分配
+static void bind_node(void *addr, size_t len, int node)
+{
+    if (node < 0 || node >= (int)(sizeof(unsigned long) * 8))
+        return;
+
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned long start = ((unsigned long)addr + page - 1) & ~(page - 1);
+    unsigned long end = ((unsigned long)addr + len) & ~(page - 1);
+    if (end <= start)
+        return;
+
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+}
+
+//定时器回调函数，关闭非活动连接
+static void cb_func(client_data *user_data)
+{
+    assert(user_data);
+    user_data->owner->expire_conn(user_data->slot);
+}
+
+reactor::reactor(int id, int port, bool reuseport, int max_conn, int timer_ms, threadpool<http_conn> *pool, bool use_uring, int cpu)
+    : m_id(id), m_port(port), m_reuseport(reuseport), m_listenfd(-1), m_epollfd(-1),
+      m_handle_signal(false), m_stop(false), m_draining(false), m_drain_deadline(-1),
+      m_peers(NULL), m_peer_num(0), m_drain_ms(0), m_keepalive_ms(5000), m_max_requests(0), m_pool(pool), m_max_conn(max_conn),
+      m_timer_wheel(timer_ms), m_timerfd(-1), m_timer_armed(-1), m_sigfd(-1), m_wakeupfd(-1),
+      m_use_uring(use_uring), m_cpu(cpu), m_node(cpu >= 0 ? cpu_node(cpu) : -1)
+{
+    m_users = new http_conn[m_max_conn];
+    m_users_timer = new client_data[m_max_conn];
+    m_fd_slot = new int[MAX_FD];
+    m_free_slots = new int[m_max_conn];
+
+    for (int i = 0; i < MAX_FD; ++i)
+        m_fd_slot[i] = -1;
+
+    //倒序入栈，使低槽位先被使用，空闲槽位的sockfd为-1
+    m_free_count = 0;
+    for (int i = m_max_conn - 1; i >= 0; --i)
+    {
+        m_free_slots[m_free_count++] = i;
+        m_users_timer[i].sockfd = -1;
+    }
+
+#ifdef WITH_IO_URING
+    m_gen = new unsigned[m_max_conn];
+    memset(m_gen, 0, sizeof(unsigned) * m_max_conn);
+    m_multishot_accept = false;
+    m_uring_retry = 0;
+    m_nobufs_recycled = 0;
+    bind_node(m_gen, sizeof(unsigned) * m_max_conn, m_node);
+#endif
+
+    //连接表放到事件循环所在的NUMA结点，http_conn的读缓冲区随之本地分配(发送缓冲区的段来自共享的池)
+    bind_node(m_users, sizeof(http_conn) * m_max_conn, m_node);
+    bind_node(m_users_timer, sizeof(client_data) * m_max_conn, m_node);
+    bind_node(m_fd_slot, sizeof(int) * MAX_FD, m_node);
+    bind_node(m_free_slots, sizeof(int) * m_max_conn, m_node);
+}
+
+reactor::~reactor()
+{
+    if (m_epollfd != -1)
+        close(m_epollfd);
+    if (m_listenfd != -1)
+        close(m_listenfd);
+    if (m_timerfd != -1)
+        close(m_timerfd);
+    if (m_sigfd != -1)
+        close(m_sigfd);
+    if (m_wakeupfd != -1)
+        close(m_wakeupfd);
+    delete[] m_users;
+    delete[] m_users_timer;
+    delete[] m_fd_slot;
+    delete[] m_free_slots;
+#ifdef WITH_IO_URING
+    delete[] m_gen;
+#endif
+}
+
+void reactor::set_keepalive(int idle_ms, int max_requests)
+{
+    m_keepalive_ms = idle_ms;
+    m_max_requests = max_requests;
+}
+
+bool reactor::init()
+{
+    /**
+     * @brief 创建监听socket文件描述符
+     *     协议族为domain、协议类型为type、协议编号为protocol
+     *     IPv4 Internet协议，TCP连接，协议中只有一种特定类型
+     */
+    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listenfd < 0)
+        return false;
+
+    /* 创建监听socket的TCP/IP的IPV4 socket地址 */
+    struct sockaddr_in address;
+    bzero(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(m_port);
+
+    // SO_REUSEADDR 允许端口被重复使用
+    int flag = 1;
+    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    // SO_REUSEPORT 多个反应堆各自绑定同一端口，由内核在它们之间分发新连接
+    if (m_reuseport && setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) < 0)
+    {
+        LOG_ERROR("reactor %d: SO_REUSEPORT errno is:%d", m_id, errno);
+        return false;
+    }
+
+    /* 绑定socket和它的地址 */
+    if (bind(m_listenfd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        return false;
+    /* 创建监听队列以存放待处理的客户连接，在这些客户连接被accept()之前 ,5个*/
+    if (listen(m_listenfd, 5) < 0)
+        return false;
+
+    // epoll后端的timerfd、eventfd设为非阻塞；io_uring后端由内核等待其可读，保持阻塞
+    int nonblock = m_use_uring ? 0 : TFD_NONBLOCK;
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | nonblock);
+    if (m_timerfd == -1)
+        return false;
+    m_wakeupfd = eventfd(0, EFD_CLOEXEC | (m_use_uring ? 0 : EFD_NONBLOCK));
+    if (m_wakeupfd == -1)
+        return false;
+
+#ifdef WITH_IO_URING
+    if (m_use_uring)
+        return init_uring();
+#endif
+
+    /* 创建一个额外的文件描述符来唯一标识内核中的epoll事件表 */
+    m_epollfd = epoll_create(5);
+    if (m_epollfd == -1)
+        return false;
+
+    // listenfd、timerfd、eventfd都需要水平触发
+    addfd_lt(m_epollfd, m_listenfd, false);
+    addfd_lt(m_epollfd, m_timerfd, false);
+    addfd_lt(m_epollfd, m_wakeupfd, false);
+    return true;
+}
+
+bool reactor::init_signal(reactor **reactors, int num, int drain_ms)
+{
+    m_peers = reactors;
+    m_peer_num = num;
+    m_drain_ms = drain_ms;
+
+    //信号已由block_signals屏蔽，只能从signalfd读出
+    sigset_t mask;
+    server_sigset(&mask);
+    m_sigfd = signalfd(-1, &mask, SFD_CLOEXEC | (m_use_uring ? 0 : SFD_NONBLOCK));
+    if (m_sigfd == -1)
+        return false;
+
+    // io_uring后端在事件循环中提交读请求
+    if (!m_use_uring)
+        addfd_lt(m_epollfd, m_sigfd, false);
+
+    m_handle_signal = true;
+    return true;
+}
+
+void reactor::stop()
+{
+    m_stop = true;
+
+    //事件循环可能阻塞在无超时的等待中，写eventfd将其唤醒
+    unsigned long long one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+}
+
+void reactor::drain(long long deadline)
+{
+    __atomic_store_n(&m_drain_deadline, deadline, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_draining, true, __ATOMIC_RELEASE);
+
+    unsigned long long one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+}
+
+long long reactor::drain_deadline() const
+{
+    if (!__atomic_load_n(&m_draining, __ATOMIC_ACQUIRE))
+        return -1;
+    return __atomic_load_n(&m_drain_deadline, __ATOMIC_RELAXED);
+}
+
+bool reactor::check_drain()
+{
+    if (!__atomic_load_n(&m_draining, __ATOMIC_ACQUIRE))
+        return false;
+    if (m_listenfd != -1)
+        start_drain();
+
+    //连接全部关闭
+    int remaining = m_max_conn - m_free_count;
+    if (remaining == 0)
+    {
+        LOG_INFO("reactor %d: drained", m_id);
+        Log::get_instance()->flush();
+        return true;
+    }
+    if (timer_now_ms() >= m_drain_deadline)
+    {
+        LOG_WARN("reactor %d: drain timeout, %d connections still open", m_id, remaining);
+        Log::get_instance()->flush();
+        return true;
+    }
+    return false;
+}
+
+void reactor::start_drain()
+{
+    //不再接受新连接，已在监听队列中尚未accept的连接被内核重置
+#ifdef WITH_IO_URING
+    if (m_use_uring)
+        uring_cancel_accept();
+    else
+#endif
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL);
+    close(m_listenfd);
+    m_listenfd = -1;
+
+    //空闲的长连接直接关闭，其余连接发送完当前响应后关闭
+    int closed = 0;
+    for (int slot = 0; slot < m_max_conn; ++slot)
+    {
+        if (m_users_timer[slot].sockfd != -1 && m_users[slot].idle() && !m_users[slot].busy())
+        {
+            close_conn(slot);
+            ++closed;
+        }
+    }
+    LOG_INFO("reactor %d: draining, %d idle connections closed, %d in flight", m_id, closed, m_max_conn - m_free_count);
+    Log::get_instance()->flush();
+}
+
+void *reactor::worker(void *arg)
+{
+    reactor *r = (reactor *)arg;
+    r->loop();
+    return r;
+}
+
+void reactor::close_conn(int slot)
+{
+    client_data *user_data = &m_users_timer[slot];
+
+#ifdef WITH_IO_URING
+    //让该连接上尚未完成的recv立即返回，并使其完成事件失效
+    if (m_use_uring)
+    {
+        shutdown(user_data->sockfd, SHUT_RDWR);
+        ++m_gen[slot];
+    }
+#endif
+
+    //删除非活动连接在socket上的注册事件，并关闭
+    m_users[slot].close_conn();
+
+    LOG_INFO("close fd %d", user_data->sockfd);
+    Log::get_instance()->flush();
+
+    //移除对应的定时器，定时器回调中调用时已经摘下
+    m_timer_wheel.del_timer(&user_data->timer);
+
+    //归还槽位
+    m_fd_slot[user_data->sockfd] = -1;
+    user_data->sockfd = -1;
+    m_free_slots[m_free_count++] = slot;
+}
+
+void reactor::expire_conn(int slot)
+{
+    //工作线程处理完会重新注册事件，之后仍按超时关闭；数据库查询等很慢时可能推迟多次
+    if (m_users[slot].busy())
+    {
+        util_timer *timer = &m_users_timer[slot].timer;
+        timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
+        m_timer_wheel.add_timer(timer);
+        return;
+    }
+    close_conn(slot);
+}
+
+void reactor::adjust_timer(int slot)
+{
+    util_timer *timer = &m_users_timer[slot].timer;
+    timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
+    m_timer_wheel.adjust_timer(timer);
+}
+
+void reactor::deal_write_done(int slot)
+{
+    //读缓冲区中还有流水线请求，不等读事件直接交给线程池
+    if (m_users[slot].pipelined())
+    {
+        dispatch(slot);
+        return;
+    }
+    //有请求只收到一部分，仍按请求超时等待其余数据
+    if (!m_users[slot].idle())
+        return;
+    //排空时长连接发送完响应即关闭
+    if (m_listenfd == -1)
+    {
+        close_conn(slot);
+        return;
+    }
+    //等待下一个请求，按空闲超时关闭
+    util_timer *timer = &m_users_timer[slot].timer;
+    timer->expire = timer_now_ms() + m_keepalive_ms;
+    m_timer_wheel.adjust_timer(timer);
+}
+
+void reactor::arm_timer()
+{
+    long long next = m_timer_wheel.next_expiry();
+    //排空时在期限到达时唤醒事件循环
+    if (m_listenfd == -1 && (next < 0 || next > m_drain_deadline))
+        next = m_drain_deadline;
+
+    //时间轮为空，或已设置的时间不晚于最近的到期时间
+    //到期时间推后的情况下timerfd会提前触发一次，tick后再按新的到期时间设置
+    if (next < 0 || (m_timer_armed >= 0 && m_timer_armed <= next))
+        return;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = next / 1000;
+    its.it_value.tv_nsec = (next % 1000) * 1000000;
+    //绝对时间，已经过去的时间会立即触发
+    if (timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+        m_timer_armed = next;
+}
+
+int reactor::add_conn(int connfd, const sockaddr_in &address)
+{
+    if (m_free_count == 0 || connfd >= MAX_FD)
+    {
+        show_error(connfd, "Internal server is busy");
+        LOG_ERROR("%s", "Internal server busy");
+        Log::get_instance()->flush();
+        return -1;
+    }
+
+    //从本反应堆连接表中分配槽位
+    int slot = m_free_slots[--m_free_count];
+    m_fd_slot[connfd] = slot;
+
+    // http与socket一一对应，epoll后端将新的socket加入本反应堆的epoll，应对后面的传输
+    //不保持连接时每个连接只处理一个请求
+    m_users[slot].init(connfd, address, m_epollfd, m_use_uring ? this : NULL, m_keepalive_ms > 0 ? m_max_requests : 1);
+
+    //初始化该连接对应的连接资源
+    client_data *user_data = &m_users_timer[slot];
+    user_data->address = address;
+    user_data->sockfd = connfd;
+    user_data->owner = this;
+    user_data->slot = slot;
+
+    //设置连接内嵌定时器的回调函数与超时时间，添加到时间轮中
+    util_timer *timer = &user_data->timer;
+    timer->user_data = user_data;
+    timer->cb_func = cb_func;
+    timer->expire = timer_now_ms() + 3 * TIMESLOT * 1000;
+    m_timer_wheel.add_timer(timer);
+    return slot;
+}
+
+void reactor::deal_accept()
+{
+    // 当listen到新的用户连接，listenfd上则产生就绪事件
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+
+    int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+    if (connfd < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "accept error", errno);
+        Log::get_instance()->flush();
+        return;
+    }
+    add_conn(connfd, client_address);
+}
+
+void reactor::deal_signal(const struct signalfd_siginfo *info, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        switch (info[i].ssi_signo)
+        {
+        //所有反应堆一起排空，已收到的请求处理完再退出
+        case SIGTERM:
+        {
+            long long deadline = timer_now_ms() + m_drain_ms;
+            LOG_INFO("SIGTERM received, draining within %dms", m_drain_ms);
+            Log::get_instance()->flush();
+            for (int j = 0; j < m_peer_num; ++j)
+                m_peers[j]->drain(deadline);
+            break;
+        }
+        //输出线程池的请求计数
+        case SIGUSR1:
+        {
+            pool_stats stats;
+            m_pool->get_stats(stats);
+            LOG_INFO("threadpool: threads %d, queued %lld, served %lld, rejected %lld, shed %lld",
+                     m_pool->thread_number(), stats.queued, stats.served, stats.rejected, stats.shed);
+            Log::get_instance()->flush();
+            break;
+        }
+        }
+    }
+}
+
+void reactor::dispatch(int slot)
+{
+    //处理读入的请求，工作窃取模式下同一连接尽量由同一工作线程处理
+    //队列已满时立即回复503，而不是让客户端等到超时；需要查询数据库的请求以低优先级入队
+    //交给线程池之前标记，工作线程在rearm中交还；入队失败时reject同样经rearm交还
+    int prio = m_users[slot].db_request() ? PRIO_LOW : PRIO_HIGH;
+    m_users[slot].set_busy();
+    if (!m_pool->append(m_users + slot, m_users_timer[slot].sockfd, prio))
+        m_users[slot].reject();
+}
+
+void reactor::deal_read(int slot)
+{
+    //读入对应缓冲区
+    if (m_users[slot].read_once())
+    {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &m_users[slot].get_address()->sin_addr, ip, sizeof(ip));
+        LOG_INFO("deal with the client(%s)", ip);
+        Log::get_instance()->flush();
+
+        dispatch(slot);
+
+        //若有数据传输，则将定时器往后延迟3个单位
+        adjust_timer(slot);
+    }
+    else
+    {
+        close_conn(slot);
+    }
+}
+
+void reactor::deal_write(int slot)
+{
+    if (m_users[slot].write())
+    {
+        //若有数据传输，则将定时器往后延迟3个单位
+        adjust_timer(slot);
+        //本批响应已发送完
+        if (!m_users[slot].writing())
+            deal_write_done(slot);
+    }
+    else
+    {
+        close_conn(slot);
+    }
+}
+
+void reactor::loop()
+{
+    if (m_cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            LOG_WARN("reactor %d: bind cpu %d failed", m_id, m_cpu);
+        else
+            LOG_INFO("reactor %d: bound to cpu %d (node %d)", m_id, m_cpu, m_node);
+        Log::get_instance()->flush();
+    }
+
+#ifdef WITH_IO_URING
+    if (m_use_uring)
+    {
+        loop_uring();
+        return;
+    }
+#endif
+
+    //超时标志
+    bool timeout = false;
+
+    while (!m_stop && !check_drain())
+    {
+        //超时由timerfd以事件的形式通知，epoll_wait无需超时
+        arm_timer();
+
+        /* 调用epoll_wait等待一组文件描述符上的事件，并将当前所有就绪的epoll_event复制到events数组中 */
+        int number = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, -1);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("%s", "epoll failure");
+            Log::get_instance()->flush();
+            break;
+        }
+
+        /* 遍历这一数组以处理这些已经就绪的事件 */
+        for (int i = 0; i < number; ++i)
+        {
+            int sockfd = m_events[i].data.fd;
+
+            //处理新到的客户连接
+            if (sockfd == m_listenfd)
+            {
+                deal_accept();
+                continue;
+            }
+            //定时器到期
+            if (sockfd == m_timerfd)
+            {
+                unsigned long long expirations;
+                read(m_timerfd, &expirations, sizeof(expirations));
+                m_timer_armed = -1;
+                timeout = true;
+                continue;
+            }
+            //处理信号，每个signalfd_siginfo对应一个信号
+            if (sockfd == m_sigfd)
+            {
+                struct signalfd_siginfo info[8];
+                int ret = read(m_sigfd, info, sizeof(info));
+                if (ret > 0)
+                    deal_signal(info, ret / sizeof(struct signalfd_siginfo));
+                continue;
+            }
+            //被stop或drain唤醒
+            if (sockfd == m_wakeupfd)
+            {
+                unsigned long long val;
+                read(m_wakeupfd, &val, sizeof(val));
+                continue;
+            }
+
+            int slot = m_fd_slot[sockfd];
+            if (slot < 0)
+                continue;
+
+            //处理异常事件，服务器关闭连接并移除对应的定时器
+            if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                close_conn(slot);
+            }
+            //处理客户连接上接收到的数据
+            else if (m_events[i].events & EPOLLIN)
+            {
+                deal_read(slot);
+            }
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                deal_write(slot);
+            }
+        }
+
+        //处理定时器为非必须事件，完成读写事件后，再进行处理
+        if (timeout)
+        {
+            m_timer_wheel.tick();
+            timeout = false;
+        }
+    }
+}
+
+#ifdef WITH_IO_URING
+bool reactor::init_uring()
+{
+    if (!m_ring.init(URING_ENTRIES))
+    {
+        LOG_ERROR("reactor %d: io_uring setup errno is:%d", m_id, errno);
+        return false;
+    }
+    //用到的操作内核都要支持(provided buffer需要5.7+)，否则回退到epoll
+    static const int ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_WRITEV, IORING_OP_READ,
+                              IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_PROVIDE_BUFFERS};
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i)
+    {
+        if (!m_ring.supports(ops[i]))
+        {
+            LOG_ERROR("reactor %d: io_uring op %d not supported", m_id, ops[i]);
+            return false;
+        }
+    }
+    m_multishot_accept = m_ring.multishot_accept();
+    //接收缓冲区由内核在数据到达时从provided buffer中挑选，空闲连接不占用缓冲区
+    if (!m_ring.provide_bufs(URING_BGID, URING_BUF_COUNT, http_conn::READ_BUFFER_SIZE))
+    {
+        LOG_ERROR("reactor %d: io_uring buffer ring errno is:%d", m_id, errno);
+        return false;
+    }
+    bind_node(m_ring.buf_addr(0), (size_t)URING_BUF_COUNT * m_ring.buf_size(), m_node);
+    return true;
+}
+
+void reactor::post(http_conn *conn, int ev)
+{
+    m_post_locker.lock();
+    bool wake = m_posted.empty();
+    m_posted.push_back(std::make_pair((int)(conn - m_users), ev));
+    m_post_locker.unlock();
+
+    //队列非空说明反应堆已被唤醒、尚未取走，不必重复写eventfd
+    if (wake)
+    {
+        unsigned long long one = 1;
+        ::write(m_wakeupfd, &one, sizeof(one));
+    }
+}
+
+void reactor::uring_accept()
+{
+    // multishot accept：一次提交，持续产生新连接的完成事件；不支持时每个连接后重新提交
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe)
+    {
+        m_uring_retry |= 1u << UD_ACCEPT;
+        return;
+    }
+    m_ring.prep_accept(sqe, m_listenfd, m_multishot_accept);
+    sqe->user_data = make_ud(UD_ACCEPT, 0, 0);
+}
+
+void reactor::uring_cancel_accept()
+{
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe)
+    {
+        m_uring_retry |= 1u;
+        return;
+    }
+    m_ring.prep_cancel(sqe, make_ud(UD_ACCEPT, 0, 0));
+    sqe->user_data = 0;
+}
+
+void reactor::uring_recv(int slot)
+{
+    //不超过读缓冲区的剩余空间，消息体较大时读缓冲区中还保留着请求头
+    //剩余空间为0时内核按整个provided buffer接收，追加失败后关闭连接，与epoll后端读满时一致
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe)
+    {
+        uring_defer(slot, UD_RECV);
+        return;
+    }
+    m_ring.prep_recv_select(sqe, m_users_timer[slot].sockfd, URING_BGID, m_users[slot].read_space());
+    sqe->user_data = make_ud(UD_RECV, slot, m_gen[slot]);
+}
+
+void reactor::uring_write(int slot)
+{
+    int count = 0;
+    struct iovec *iov = m_users[slot].write_iov(count);
+    if (count == 0)
+    {
+        //工作线程生成响应失败
+        close_conn(slot);
+        return;
+    }
+
+    //超过IOV_MAX段时分次提交，剩余部分由写完成事件继续
+    bool last = count <= IOV_MAX;
+    if (!last)
+        count = IOV_MAX;
+    //长连接在writev之后链接一个recv，与writev同批提交
+    //writev未写完时链接会被内核取消，recv以-ECANCELED完成，由写完成事件重新提交
+    //send部分发送也算成功，链接的recv照常执行，因此链接时总是用writev
+    //读缓冲区中还有流水线请求时不链接，写完后直接交给线程池；之后还要sendfile或分次提交时，发送完再提交recv
+    bool link = last && m_users[slot].linger() && !m_users[slot].pipelined() && !m_users[slot].file_pending();
+
+    //链接的writev和recv必须在同一批提交，先预留两个SQE
+    if (!m_ring.reserve(link ? 2 : 1))
+    {
+        uring_defer(slot, UD_WRITE);
+        return;
+    }
+    int sockfd = m_users_timer[slot].sockfd;
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    //只有一段且不链接时(如短连接的预先生成的响应)用send，省去内核拷贝iovec数组
+    if (count == 1 && !link)
+        m_ring.prep_send(sqe, sockfd, iov->iov_base, iov->iov_len);
+    else
+        m_ring.prep_writev(sqe, sockfd, iov, count);
+    sqe->user_data = make_ud(UD_WRITE, slot, m_gen[slot]);
+
+    if (link)
+    {
+        sqe->flags |= IOSQE_IO_LINK;
+        uring_recv(slot);
+    }
+}
+
+void reactor::uring_read(int fd, void *buf, unsigned len, int type)
+{
+    struct io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe)
+    {
+        m_uring_retry |= 1u << type;
+        return;
+    }
+    m_ring.prep_read(sqe, fd, buf, len);
+    sqe->user_data = make_ud(type, 0, 0);
+}
+
+void reactor::deal_uring_recv(int slot, int res, unsigned flags)
+{
+    if (res == -ECANCELED)
+        return;
+    if (res == -ENOBUFS)
+    {
+        //provided buffer暂时用尽，等有缓冲区归还后再重新提交
+        uring_deferred d;
+        d.slot = slot;
+        d.gen = m_gen[slot];
+        d.type = UD_RECV;
+        m_nobufs.push_back(d);
+        return;
+    }
+    if (res <= 0)
+    {
+        close_conn(slot);
+        return;
+    }
+
+    //取出内核选中的缓冲区，拷入连接的读缓冲区后立即归还
+    unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    bool ok = m_users[slot].read_append(m_ring.buf_addr(bid), res);
+    m_ring.recycle_buf(bid);
+    if (!ok)
+    {
+        close_conn(slot);
+        return;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_users[slot].get_address()->sin_addr, ip, sizeof(ip));
+    LOG_INFO("deal with the client(%s)", ip);
+    Log::get_instance()->flush();
+
+    dispatch(slot);
+
+    //若有数据传输，则将定时器往后延迟3个单位
+    adjust_timer(slot);
+}
+
+void reactor::deal_uring_write(int slot, int res)
+{
+    if (res == -EAGAIN || res == -EINTR)
+    {
+        uring_write(slot);
+        return;
+    }
+    if (res < 0)
+    {
+        close_conn(slot);
+        return;
+    }
+
+    adjust_timer(slot);
+
+    //未写完，继续提交剩余部分
+    if (m_users[slot].write_advance(res))
+    {
+        uring_write(slot);
+        return;
+    }
+    if (m_users[slot].file_pending())
+    {
+        uring_send_file(slot);
+        return;
+    }
+
+    //短连接发送完毕即关闭，长连接的recv已经链接在writev之后
+    if (!m_users[slot].write_done())
+        close_conn(slot);
+    else
+        deal_write_done(slot);
+}
+
+void reactor::uring_send_file(int slot)
+{
+    while (m_users[slot].file_pending())
+    {
+        int n = m_users[slot].send_file();
+        if (n < 0 && errno == EAGAIN)
+        {
+            struct io_uring_sqe *sqe = m_ring.get_sqe();
+            if (!sqe)
+            {
+                uring_defer(slot, UD_SENDFILE);
+                return;
+            }
+            m_ring.prep_poll_add(sqe, m_users_timer[slot].sockfd, POLLOUT);
+            sqe->user_data = make_ud(UD_SENDFILE, slot, m_gen[slot]);
+            return;
+        }
+        //出错，或文件在发送过程中被截短
+        if (n <= 0)
+        {
+            close_conn(slot);
+            return;
+        }
+        adjust_timer(slot);
+    }
+
+    if (!m_users[slot].write_done())
+    {
+        close_conn(slot);
+        return;
+    }
+    //没有链接在writev之后的recv，在这里提交
+    if (!m_users[slot].pipelined())
+        uring_recv(slot);
+    deal_write_done(slot);
+}
+
+void reactor::deal_posted()
+{
+    std::vector<std::pair<int, int> > posted;
+    m_post_locker.lock();
+    posted.swap(m_posted);
+    m_post_locker.unlock();
+
+    for (size_t i = 0; i < posted.size(); ++i)
+    {
+        int slot = posted[i].first;
+        //连接已被关闭
+        if (m_users_timer[slot].sockfd < 0)
+            continue;
+        if (posted[i].second == EPOLLOUT)
+            uring_write(slot);
+        else
+            uring_recv(slot);
+    }
+}
+
+void reactor::uring_defer(int slot, int type)
+{
+    uring_deferred d;
+    d.slot = slot;
+    d.gen = m_gen[slot];
+    d.type = type;
+    m_deferred.push_back(d);
+}
+
+void reactor::uring_retry()
+{
+    unsigned retry = m_uring_retry;
+    m_uring_retry = 0;
+    if ((retry & (1u << UD_ACCEPT)) && m_listenfd != -1)
+        uring_accept();
+    if (retry & 1u)
+        uring_cancel_accept();
+    if (retry & (1u << UD_TIMER))
+        uring_read(m_timerfd, &m_timer_val, sizeof(m_timer_val), UD_TIMER);
+    if (retry & (1u << UD_WAKEUP))
+        uring_read(m_wakeupfd, &m_wakeup_val, sizeof(m_wakeup_val), UD_WAKEUP);
+    if (retry & (1u << UD_SIGNAL))
+        uring_read(m_sigfd, m_siginfo, sizeof(m_siginfo), UD_SIGNAL);
+
+    //上一次提交之后有缓冲区归还(包括本轮处理完成事件时归还的)，等待缓冲区的recv可以重试
+    if (!m_nobufs.empty() && m_ring.recycled() != m_nobufs_recycled)
+    {
+        m_deferred.insert(m_deferred.end(), m_nobufs.begin(), m_nobufs.end());
+        m_nobufs.clear();
+    }
+    m_nobufs_recycled = m_ring.recycled();
+
+    //再次失败的请求重新记下，留到下一轮
+    std::vector<uring_deferred> deferred;
+    deferred.swap(m_deferred);
+    for (size_t i = 0; i < deferred.size(); ++i)
+    {
+        int slot = deferred[i].slot;
+        //连接已被关闭或槽位已给了新连接
+        if (deferred[i].gen != m_gen[slot] || m_users_timer[slot].sockfd < 0)
+            continue;
+        if (deferred[i].type == UD_RECV)
+            uring_recv(slot);
+        else if (deferred[i].type == UD_WRITE)
+            uring_write(slot);
+        else
+            uring_send_file(slot);
+    }
+}
+
+void reactor::loop_uring()
+{
+    //超时标志
+    bool timeout = false;
+
+    uring_accept();
+    uring_read(m_timerfd, &m_timer_val, sizeof(m_timer_val), UD_TIMER);
+    uring_read(m_wakeupfd, &m_wakeup_val, sizeof(m_wakeup_val), UD_WAKEUP);
+    if (m_handle_signal)
+        uring_read(m_sigfd, m_siginfo, sizeof(m_siginfo), UD_SIGNAL);
+
+    while (!m_stop && !check_drain())
+    {
+        arm_timer();
+        uring_retry();
+
+        //本轮产生的所有请求一次提交，同时等待至少一个完成事件
+        int ret = m_ring.submit_and_wait(1);
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY)
+        {
+            LOG_ERROR("io_uring_enter failure:%d", -ret);
+            Log::get_instance()->flush();
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = m_ring.peek_cqe()) != NULL)
+        {
+            unsigned long long ud = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            m_ring.cqe_seen();
+
+            int type = (int)(ud >> 56);
+            unsigned gen = (unsigned)(ud >> 24);
+            int slot = (int)(ud & 0xffffff);
+
+            switch (type)
+            {
+            case UD_ACCEPT:
+            {
+                //排空开始前已经accept的连接直接关闭
+                if (res >= 0 && m_listenfd == -1)
+                {
+                    close(res);
+                }
+                else if (res >= 0)
+                {
+                    struct sockaddr_in client_address;
+                    socklen_t client_addrlength = sizeof(client_address);
+                    getpeername(res, (struct sockaddr *)&client_address, &client_addrlength);
+                    int new_slot = add_conn(res, client_address);
+                    if (new_slot >= 0)
+                        uring_recv(new_slot);
+                }
+                else if (res == -EINVAL && m_multishot_accept)
+                {
+                    //内核不接受multishot标志(按版本判断有误，如裁剪过的内核)，改为每次accept一个连接
+                    LOG_WARN("reactor %d: multishot accept unsupported, falling back to single-shot", m_id);
+                    m_multishot_accept = false;
+                }
+                else if (res != -ECANCELED)
+                {
+                    LOG_ERROR("%s:errno is:%d", "accept error", -res);
+                    Log::get_instance()->flush();
+                }
+                //内核终止了multishot，重新提交；排空时已被取消
+                if (!(flags & IORING_CQE_F_MORE) && m_listenfd != -1)
+                    uring_accept();
+                break;
+            }
+            case UD_RECV:
+            {
+                //已关闭连接的残留事件，只需归还缓冲区
+                if (gen != m_gen[slot])
+                {
+                    if (res > 0 && (flags & IORING_CQE_F_BUFFER))
+                        m_ring.recycle_buf(flags >> IORING_CQE_BUFFER_SHIFT);
+                    break;
+                }
+                deal_uring_recv(slot, res, flags);
+                break;
+            }
+            case UD_WRITE:
+            {
+                if (gen == m_gen[slot])
+                    deal_uring_write(slot, res);
+                break;
+            }
+            case UD_SENDFILE:
+            {
+                if (gen == m_gen[slot])
+                {
+                    if (res < 0)
+                        close_conn(slot);
+                    else
+                        uring_send_file(slot);
+                }
+                break;
+            }
+            case UD_TIMER:
+            {
+                m_timer_armed = -1;
+                timeout = true;
+                uring_read(m_timerfd, &m_timer_val, sizeof(m_timer_val), UD_TIMER);
+                break;
+            }
+            case UD_WAKEUP:
+            {
+                uring_read(m_wakeupfd, &m_wakeup_val, sizeof(m_wakeup_val), UD_WAKEUP);
+                deal_posted();
+                break;
+            }
+            case UD_SIGNAL:
+            {
+                if (res > 0)
+                    deal_signal(m_siginfo, res / sizeof(struct signalfd_siginfo));
+                uring_read(m_sigfd, m_siginfo, sizeof(m_siginfo), UD_SIGNAL);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        //处理定时器为非必须事件，完成读写事件后，再进行处理
+        if (timeout)
+        {
+            m_timer_wheel.tick();
+            timeout = false;
+        }
+    }
+}
+#endif
@@ -0,0 +1,183 @@
+#pragma once
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <vector>
+#include <utility>
+
+#include "../threadpool/threadpool.h"
+#include "../timer/lst_timer.h"
+#include "../http/http_conn.h"
+#ifdef WITH_IO_URING
+#include "uring.h"
+#endif
+
+#define MAX_FD 65536           //最大文件描述符
+#define MAX_EVENT_NUMBER 10000 //最大事件数
+#define TIMESLOT 5             //连接超时的基本单位，秒
+
+//设置信号的处理函数
+void addsig(int sig, void(handler)(int), bool restart = true);
+//在所有线程中屏蔽由signalfd接收的信号(SIGTERM、SIGUSR1)，须在创建任何线程之前调用
+void block_signals();
+
+//反应堆：一个epoll事件循环，负责监听socket上的accept、连接上的读写和超时定时器
+//定时器由timerfd驱动，按时间轮最近的到期时间设置，没有到期的连接时事件循环不会被唤醒
+//多反应堆模式下，每个反应堆各自持有epoll、SO_REUSEPORT监听socket、连接表和定时器链表，彼此不共享状态
+//报文解析(http_conn::process)仍然交给共享的线程池
+// I/O后端可选epoll或io_uring(编译时定义WITH_IO_URING)，两者共用连接表和定时器
+class reactor
+{
+public:
+    // id为反应堆编号，reuseport为是否以SO_REUSEPORT方式监听，max_conn为该反应堆连接表的容量
+    // timer_ms为时间轮的刻度(毫秒)，use_uring为是否使用io_uring后端
+    // cpu为事件循环绑定的CPU，-1为不绑定；绑定时连接表等内存放在该CPU所在的NUMA结点上
+    reactor(int id, int port, bool reuseport, int max_conn, int timer_ms, threadpool<http_conn> *pool, bool use_uring = false, int cpu = -1);
+    ~reactor();
+
+    //长连接的空闲超时(毫秒，0为不保持连接)和每个连接最多处理的请求数(0为不限制)，在init之前调用
+    void set_keepalive(int idle_ms, int max_requests);
+    //创建监听socket、timerfd、eventfd，以及epoll或io_uring实例
+    bool init();
+    //创建signalfd接收SIGTERM和SIGUSR1(把线程池的请求计数写入日志)，只有一个反应堆调用
+    //收到SIGTERM时reactors中的num个反应堆(包括自己)一起排空，期限为drain_ms毫秒
+    bool init_signal(reactor **reactors, int num, int drain_ms);
+    //事件循环，直到stop被调用或排空结束；先把当前线程绑定到指定的CPU
+    void loop();
+    //通知事件循环立即退出，线程安全
+    void stop();
+    //通知事件循环排空，线程安全：关闭监听socket不再接受新连接，关闭空闲的长连接，
+    //已收到的请求处理完、响应发送完后关闭连接；连接全部关闭或到达deadline(单调时钟毫秒)时事件循环退出
+    void drain(long long deadline);
+    //排空的期限，没有在排空时返回-1
+    long long drain_deadline() const;
+
+    //关闭连接，移除对应的定时器并归还连接表槽位
+    void close_conn(int slot);
+    //定时器到期：连接在线程池中处理时推迟到下一个超时周期，否则关闭
+    void expire_conn(int slot);
+
+    //工作线程处理完报文后请求重新注册事件(EPOLLIN/EPOLLOUT)，仅io_uring后端使用，线程安全
+    void post(http_conn *conn, int ev);
+
+    //线程入口，参数为reactor对象
+    static void *worker(void *arg);
+
+private:
+    //为新连接分配槽位并创建定时器，失败返回-1
+    int add_conn(int connfd, const sockaddr_in &address);
+    void deal_accept();
+    //处理从signalfd读出的信号
+    void deal_signal(const struct signalfd_siginfo *info, int n);
+    //把连接交给线程池处理读缓冲区中的请求，队列已满时回复503
+    void dispatch(int slot);
+    void deal_read(int slot);
+    void deal_write(int slot);
+    //连接上有数据传输，将定时器往后延迟3个单位
+    void adjust_timer(int slot);
+    //响应发送完后：读缓冲区中有流水线请求时交给线程池；长连接空闲时定时器改为空闲超时，排空时直接关闭
+    void deal_write_done(int slot);
+    //按时间轮最近的到期时间设置timerfd，已设置的时间不晚于它时不做系统调用；排空时不晚于排空期限
+    void arm_timer();
+    //排空时停止accept并关闭空闲连接，返回事件循环是否应该退出
+    bool check_drain();
+    void start_drain();
+
+#ifdef WITH_IO_URING
+    // io_uring后端的事件循环，每轮一次io_uring_enter完成批量提交和等待
+    bool init_uring();
+    void loop_uring();
+    void uring_accept();
+    void uring_cancel_accept();
+    void uring_recv(int slot);
+    //提交响应，长连接时链接一个recv，写完即开始接收下一个请求
+    void uring_write(int slot);
+    void uring_read(int fd, void *buf, unsigned len, int type);
+    void deal_uring_recv(int slot, int res, unsigned flags);
+    void deal_uring_write(int slot, int res);
+    // io_uring没有sendfile操作：writev完成后在反应堆线程中以非阻塞的sendfile发送文件，发送缓冲区满时等待POLLOUT
+    void uring_send_file(int slot);
+    void deal_posted();
+    //提交队列暂时没有空位(内核未取走已有请求)时记下要重新提交的请求，在下一轮提交前重试
+    void uring_defer(int slot, int type);
+    void uring_retry();
+#endif
+
+private:
+    int m_id;
+    int m_port;
+    bool m_reuseport;
+    int m_listenfd;
+    int m_epollfd;
+    bool m_handle_signal;
+    volatile bool m_stop;
+    //是否在排空，及其期限，由其他线程设置
+    bool m_draining;
+    long long m_drain_deadline;
+    //收到SIGTERM时一起排空的反应堆
+    reactor **m_peers;
+    int m_peer_num;
+    int m_drain_ms;
+    //长连接空闲超时和每个连接最多处理的请求数
+    int m_keepalive_ms;
+    int m_max_requests;
+    threadpool<http_conn> *m_pool;
+
+    //连接表，按槽位下标访问
+    int m_max_conn;
+    http_conn *m_users;
+    client_data *m_users_timer;
+    // sockfd到槽位的映射，-1表示该fd不属于本反应堆
+    int *m_fd_slot;
+    //空闲槽位栈
+    int *m_free_slots;
+    int m_free_count;
+
+    //时间轮，及驱动它的timerfd和当前设置的到期时间(单调时钟毫秒，-1为未设置)
+    time_wheel m_timer_wheel;
+    int m_timerfd;
+    long long m_timer_armed;
+    // signalfd，只有处理信号的反应堆创建
+    int m_sigfd;
+    //唤醒事件循环的eventfd，用于stop及io_uring后端工作线程的通知
+    int m_wakeupfd;
+
+    //用于存储epoll事件表中就绪事件的event数组
+    epoll_event m_events[MAX_EVENT_NUMBER];
+
+    bool m_use_uring;
+
+    //绑定的CPU及其NUMA结点，-1为不绑定/未知
+    int m_cpu;
+    int m_node;
+#ifdef WITH_IO_URING
+    uring m_ring;
+    //槽位的代数，连接关闭时加一，用于丢弃旧连接残留的完成事件
+    unsigned *m_gen;
+    //工作线程通知的(槽位, 事件)队列
+    locker m_post_locker;
+    std::vector<std::pair<int, int> > m_posted;
+    // eventfd、timerfd、signalfd读请求的缓冲区
+    unsigned long long m_wakeup_val;
+    unsigned long long m_timer_val;
+    struct signalfd_siginfo m_siginfo[8];
+    //使用multishot accept，内核不支持时改为每次accept一个连接
+    bool m_multishot_accept;
+    //没能提交、等待重试的accept、取消accept和timerfd、eventfd、signalfd读请求，按user_data的类型编号取位，第0位为取消accept
+    unsigned m_uring_retry;
+    //没能提交、等待重试的连接上的请求：(槽位, 槽位代数, 请求类型)
+    struct uring_deferred
+    {
+        int slot;
+        unsigned gen;
+        int type;
+    };
+    std::vector<uring_deferred> m_deferred;
+    //因provided buffer用尽(-ENOBUFS)失败的recv，有缓冲区归还后才重新提交，否则下一次提交同样失败，反复空转
+    std::vector<uring_deferred> m_nobufs;
+    //上一次提交前的归还计数，之后有归还时m_nobufs中的recv移入m_deferred
+    unsigned long m_nobufs_recycled;
+#endif
+};
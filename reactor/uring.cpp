@@ -0,0 +1,309 @@
+#include "uring.h"
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <stdio.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring::uring()
+    : m_ring_fd(-1), m_sq_entries(0), m_cq_entries(0), m_sq_ptr(MAP_FAILED), m_sq_size(0),
+      m_cq_ptr(MAP_FAILED), m_cq_size(0), m_sqes((struct io_uring_sqe *)MAP_FAILED),
+      m_sqe_head(0), m_sqe_tail(0), m_cqe_skip(false), m_multishot_accept(false), m_bufs(NULL), m_buf_count(0),
+      m_buf_size(0), m_bgid(0), m_recycle(NULL), m_recycle_count(0),
+      m_recycled(0)
+{
+    memset(m_ops, 0, sizeof(m_ops));
+}
+
+uring::~uring()
+{
+    free(m_recycle);
+    free(m_bufs);
+    if (m_sqes != MAP_FAILED)
+        munmap(m_sqes, m_sq_entries * sizeof(struct io_uring_sqe));
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_size);
+    if (m_ring_fd != -1)
+        close(m_ring_fd);
+}
+
+bool uring::init(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 2;
+
+    m_ring_fd = sys_io_uring_setup(entries, &p);
+    if (m_ring_fd < 0)
+    {
+        m_ring_fd = -1;
+        return false;
+    }
+    m_sq_entries = p.sq_entries;
+    m_cq_entries = p.cq_entries;
+    m_cqe_skip = p.features & IORING_FEAT_CQE_SKIP;
+
+    //新内核SQ和CQ可以共用一次映射
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && m_cq_size > m_sq_size)
+        m_sq_size = m_cq_size;
+
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+        return false;
+
+    if (single_mmap)
+    {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+            return false;
+    }
+
+    m_sqes = (struct io_uring_sqe *)mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+        return false;
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sqe_head = m_sqe_tail = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    //查询支持的操作，不支持probe(5.6之前)时视为都不支持，由调用者回退
+    size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probe_len);
+    if (probe && sys_io_uring_register(m_ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        for (int i = 0; i < probe->ops_len; ++i)
+        {
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED)
+                m_ops[probe->ops[i].op] = 1;
+        }
+    }
+    free(probe);
+
+    // multishot accept是IORING_OP_ACCEPT的标志位，probe查不到，按内核版本判断
+    struct utsname u;
+    int major = 0, minor = 0;
+    if (uname(&u) == 0)
+        sscanf(u.release, "%d.%d", &major, &minor);
+    m_multishot_accept = supports(IORING_OP_ACCEPT) && (major > 5 || (major == 5 && minor >= 19));
+    return true;
+}
+
+unsigned uring::sq_space() const
+{
+    return m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE));
+}
+
+bool uring::reserve(unsigned n)
+{
+    if (sq_space() >= n)
+        return true;
+    //提交队列已满，先交给内核
+    submit_and_wait(0);
+    return sq_space() >= n;
+}
+
+struct io_uring_sqe *uring::get_sqe()
+{
+    if (!reserve(1))
+        return NULL;
+    struct io_uring_sqe *sqe = &m_sqes[m_sqe_tail & *m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++m_sqe_tail;
+    return sqe;
+}
+
+unsigned uring::flush_sq()
+{
+    unsigned tail = *m_sq_tail;
+    unsigned to_submit = m_sqe_tail - m_sqe_head;
+    for (; m_sqe_head != m_sqe_tail; ++m_sqe_head, ++tail)
+        m_sq_array[tail & *m_sq_mask] = m_sqe_head & *m_sq_mask;
+    __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+    return to_submit;
+}
+
+int uring::submit_and_wait(unsigned wait_nr)
+{
+    recycle_pending();
+    unsigned to_submit = flush_sq();
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+
+    //一次系统调用完成批量提交和等待
+    int ret;
+    do
+    {
+        ret = sys_io_uring_enter(m_ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR && wait_nr == 0);
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe *uring::peek_cqe()
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &m_cqes[head & *m_cq_mask];
+}
+
+void uring::cqe_seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring::provide_bufs(unsigned short bgid, unsigned count, unsigned size)
+{
+    m_bufs = (char *)malloc((size_t)count * size);
+    if (!m_bufs)
+        return false;
+    m_buf_count = count;
+    m_buf_size = size;
+    m_bgid = bgid;
+    m_recycle = (unsigned short *)malloc(count * sizeof(unsigned short));
+    if (!m_recycle)
+        return false;
+
+    //一次提交全部缓冲区，并确认内核接受
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (unsigned long)m_bufs;
+    sqe->len = size;
+    sqe->buf_group = bgid;
+    sqe->off = 0;
+    sqe->user_data = 0;
+    if (submit_and_wait(1) < 0)
+        return false;
+
+    struct io_uring_cqe *cqe = peek_cqe();
+    if (!cqe)
+        return false;
+    int res = cqe->res;
+    cqe_seen();
+    return res >= 0;
+}
+
+void uring::recycle_buf(unsigned short bid)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        //每个缓冲区最多被取出一次，不会超过m_buf_count
+        m_recycle[m_recycle_count++] = bid;
+        return;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (unsigned long)buf_addr(bid);
+    sqe->len = m_buf_size;
+    sqe->buf_group = m_bgid;
+    sqe->off = bid;
+    sqe->user_data = 0;
+    if (m_cqe_skip)
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+    ++m_recycled;
+}
+
+void uring::recycle_pending()
+{
+    //只使用空闲的SQE，不在这里再次提交
+    while (m_recycle_count > 0 && sq_space() > 0)
+    {
+        unsigned short bid = m_recycle[--m_recycle_count];
+        recycle_buf(bid);
+    }
+}
+
+void uring::prep_accept(struct io_uring_sqe *sqe, int fd, bool multishot)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    if (multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+void uring::prep_recv_select(struct io_uring_sqe *sqe, int fd, unsigned short bgid, unsigned len)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = len;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+}
+
+void uring::prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, int count)
+{
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)iov;
+    sqe->len = count;
+}
+
+void uring::prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, unsigned len)
+{
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+}
+
+void uring::prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len)
+{
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+}
+
+void uring::prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned events)
+{
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+}
+
+void uring::prep_cancel(struct io_uring_sqe *sqe, unsigned long long target)
+{
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+}
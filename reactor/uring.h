@@ -0,0 +1,111 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <string.h>
+
+//对io_uring系统调用接口的最小封装，不依赖liburing
+//只提供本项目用到的操作：取SQE、批量提交并等待、遍历CQE、provided buffer
+//非线程安全，只能由所属反应堆线程使用
+class uring
+{
+public:
+    uring();
+    ~uring();
+
+    // entries为提交队列长度，完成队列长度为其两倍
+    //同时用IORING_REGISTER_PROBE(5.6+)查询内核支持的操作
+    bool init(unsigned entries);
+
+    //内核是否支持操作码op
+    bool supports(int op) const { return op >= 0 && op < 256 && m_ops[op]; }
+    //内核是否支持multishot accept(5.19+)，不支持时每次accept一个连接
+    bool multishot_accept() const { return m_multishot_accept; }
+
+    //取一个空闲SQE，提交队列满时先提交已有请求；内核仍未取走(如CQ溢出时的-EBUSY)时返回NULL，由调用者稍后重试
+    struct io_uring_sqe *get_sqe();
+    //保证接下来的n个get_sqe不会返回NULL，也不会中途提交(链接的请求必须在同一批提交)；不足时先提交已有请求，仍不足返回false
+    bool reserve(unsigned n);
+
+    //提交所有已准备的SQE，并至少等待wait_nr个完成事件，返回提交数量或-errno
+    int submit_and_wait(unsigned wait_nr);
+
+    //取下一个完成事件，没有则返回NULL；处理完后调用cqe_seen
+    struct io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+    //提供count个大小为size的接收缓冲区，组号为bgid，recv时由内核挑选
+    //使用IORING_OP_PROVIDE_BUFFERS(5.7+)，归还缓冲区只需随下一批请求提交，不额外进入内核
+    bool provide_bufs(unsigned short bgid, unsigned count, unsigned size);
+    //取得provided buffer的地址
+    char *buf_addr(unsigned short bid) { return m_bufs + (size_t)bid * m_buf_size; }
+    unsigned buf_size() const { return m_buf_size; }
+    //用完的provided buffer归还给内核，产生的完成事件user_data为0
+    //提交队列暂时没有空位时记下，在下一次提交前归还
+    void recycle_buf(unsigned short bid);
+    //已归还的provided buffer个数(提交了归还请求即算)，反应堆据此判断因缓冲区用尽失败的recv是否值得重新提交
+    unsigned long recycled() const { return m_recycled; }
+
+    //常用请求的SQE填充
+    // multishot为true时一次提交持续产生新连接的完成事件，否则每个完成事件后需重新提交
+    void prep_accept(struct io_uring_sqe *sqe, int fd, bool multishot);
+    // len为最多接收的字节数，小于provided buffer时只使用缓冲区的前len字节
+    void prep_recv_select(struct io_uring_sqe *sqe, int fd, unsigned short bgid, unsigned len);
+    void prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, int count);
+    //部分发送也算成功，不会取消其后链接的请求，需要链接时用prep_writev
+    void prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, unsigned len);
+    void prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len);
+    //等待fd上的事件(poll(2)的事件位)，触发一次后结束
+    void prep_poll_add(struct io_uring_sqe *sqe, int fd, unsigned events);
+    //取消user_data为target的请求(如multishot accept)
+    void prep_cancel(struct io_uring_sqe *sqe, unsigned long long target);
+
+private:
+    //提交队列的空闲SQE个数
+    unsigned sq_space() const;
+    //把本地已准备的SQE发布到提交队列
+    unsigned flush_sq();
+    //归还之前没有空位归还的provided buffer
+    void recycle_pending();
+
+private:
+    int m_ring_fd;
+    unsigned m_sq_entries;
+    unsigned m_cq_entries;
+
+    //映射的环形队列内存
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    struct io_uring_sqe *m_sqes;
+
+    //提交队列
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sqe_head; //已发布到内核的位置
+    unsigned m_sqe_tail; //本地已准备的位置
+
+    //完成队列
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    //内核支持IOSQE_CQE_SKIP_SUCCESS时，归还缓冲区成功不产生完成事件
+    bool m_cqe_skip;
+    //按操作码记录内核是否支持
+    unsigned char m_ops[256];
+    bool m_multishot_accept;
+
+    // provided buffer
+    char *m_bufs;
+    unsigned m_buf_count;
+    unsigned m_buf_size;
+    unsigned short m_bgid;
+    //等待归还的provided buffer
+    unsigned short *m_recycle;
+    unsigned m_recycle_count;
+    unsigned long m_recycled;
+};
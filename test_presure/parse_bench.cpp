@@ -0,0 +1,192 @@
+//请求报文扫描的微基准：逐字节的从状态机与http_scan.h的向量化扫描对比，输出GB/s
+//编译：g++ -O2 -o parse_bench parse_bench.cpp            (SSE2)
+//      g++ -O2 -mavx2 -o parse_bench parse_bench.cpp     (AVX2)
+//运行：./parse_bench [轮数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "../http/http_scan.h"
+
+//典型的浏览器GET请求
+static const char *sample =
+    "GET /static/js/app.3f9a1c.js?v=20240101 HTTP/1.1\r\n"
+    "Host: www.example.com:8001\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; lang=zh-CN\r\n"
+    "Referer: http://www.example.com:8001/index.html\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "\r\n";
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//原来的parse_line：逐字节查找\r\n，返回行尾位置，不完整返回-1
+static int legacy_line(const char *buf, int &checked, int read_idx)
+{
+    for (; checked < read_idx; ++checked)
+    {
+        char c = buf[checked];
+        if (c == '\r')
+        {
+            if (checked + 1 == read_idx)
+                return -1;
+            if (buf[checked + 1] == '\n')
+            {
+                int end = checked;
+                checked += 2;
+                return end;
+            }
+            return -2;
+        }
+        else if (c == '\n')
+            return -2;
+    }
+    return -1;
+}
+
+//向量化的parse_line
+static int simd_line(const char *buf, int &checked, int read_idx)
+{
+    checked = scan_line_end(buf, checked, read_idx);
+    if (checked == read_idx)
+        return -1;
+    if (buf[checked] == '\r')
+    {
+        if (checked + 1 == read_idx)
+            return -1;
+        if (buf[checked + 1] == '\n')
+        {
+            int end = checked;
+            checked += 2;
+            return end;
+        }
+    }
+    return -2;
+}
+
+//请求行的两个分隔符位置，原来的做法需要先把行尾改为\0，再用strpbrk、strspn
+static long legacy_tokens(char *line, char *end)
+{
+    char save = *end;
+    *end = '\0';
+    char *url = strpbrk(line, " \t");
+    url += strspn(url, " \t");
+    char *version = strpbrk(url, " \t");
+    *end = save;
+    return (url - line) + (version - line);
+}
+
+static long simd_tokens(char *line, char *end)
+{
+    char *url = skip_blank(scan_token_end(line, end), end);
+    char *version = scan_token_end(url, end);
+    return (url - line) + (version - line);
+}
+
+typedef int (*line_fn)(const char *, int &, int);
+
+//把缓冲区按chunk大小分批"到达"，模拟多次recv，检验增量扫描，返回所有行尾位置之和
+static long run_lines(line_fn fn, const char *buf, int len, int chunk)
+{
+    long sum = 0;
+    int checked = 0;
+    for (int read_idx = chunk < len ? chunk : len;; read_idx = read_idx + chunk < len ? read_idx + chunk : len)
+    {
+        int end;
+        while ((end = fn(buf, checked, read_idx)) >= 0)
+            sum += end;
+        if (end == -2)
+        {
+            fprintf(stderr, "bad line at %d\n", checked);
+            exit(1);
+        }
+        if (read_idx == len)
+            break;
+    }
+    return sum;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+
+    //连续的若干个请求，约等于一次读满读缓冲区
+    std::string data;
+    while (data.size() + strlen(sample) <= 2048)
+        data += sample;
+    std::vector<char> buf(data.begin(), data.end());
+    int len = (int)buf.size();
+    char *line = &buf[0];
+    char *line_end = strstr(line, "\r\n");
+
+#if defined(__AVX2__)
+    const char *isa = "AVX2";
+#elif defined(__SSE2__)
+    const char *isa = "SSE2";
+#else
+    const char *isa = "scalar";
+#endif
+    printf("%d bytes per round, %d rounds, vector path: %s\n", len, rounds, isa);
+
+    //两种实现找到的行尾必须一致，无论数据如何分批到达
+    int chunks[] = {1, 7, 64, 536, 2048};
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i)
+    {
+        if (run_lines(legacy_line, line, len, chunks[i]) != run_lines(simd_line, line, len, chunks[i]))
+        {
+            fprintf(stderr, "mismatch with chunk %d\n", chunks[i]);
+            return 1;
+        }
+    }
+
+    struct
+    {
+        const char *name;
+        line_fn fn;
+        int chunk;
+    } cases[] = {
+        {"line  legacy  whole", legacy_line, len},
+        {"line  simd    whole", simd_line, len},
+        {"line  legacy  536B ", legacy_line, 536},
+        {"line  simd    536B ", simd_line, 536},
+    };
+    volatile long sink = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c)
+    {
+        double t = now_sec();
+        for (int r = 0; r < rounds; ++r)
+            sink += run_lines(cases[c].fn, line, len, cases[c].chunk);
+        t = now_sec() - t;
+        printf("%s  %6.2f GB/s\n", cases[c].name, (double)len * rounds / t / 1e9);
+    }
+
+    //请求行的切分
+    int line_len = (int)(line_end - line);
+    long tokens[2] = {0, 0};
+    for (int k = 0; k < 2; ++k)
+    {
+        double t = now_sec();
+        for (int r = 0; r < rounds * 10; ++r)
+            tokens[k] += k == 0 ? legacy_tokens(line, line_end) : simd_tokens(line, line_end);
+        t = now_sec() - t;
+        printf("token %s         %6.2f GB/s\n", k == 0 ? "legacy" : "simd  ", (double)line_len * rounds * 10 / t / 1e9);
+    }
+    if (tokens[0] != tokens[1])
+    {
+        fprintf(stderr, "token mismatch\n");
+        return 1;
+    }
+    return sink == 0;
+}
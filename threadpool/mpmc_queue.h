@@ -0,0 +1,121 @@
+#pragma once
+#include <stddef.h>
+#include <exception>
+
+#ifndef CACHELINE_SIZE
+#define CACHELINE_SIZE 64
+#endif
+
+//有界无锁多生产者多消费者环形队列(Dmitry Vyukov)
+//每个槽位带一个序号，生产者和消费者各自用CAS推进位置，入队出队都不分配内存
+//容量向上取整为2的幂
+template <typename T>
+class mpmc_queue
+{
+public:
+    mpmc_queue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        m_buffer = new cell[size];
+        m_mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            m_buffer[i].seq = i;
+        m_enqueue_pos = 0;
+        m_dequeue_pos = 0;
+    }
+    ~mpmc_queue()
+    {
+        delete[] m_buffer;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+    //队列中的元素个数，并发修改时只是近似值
+    size_t size() const
+    {
+        size_t deq = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+        size_t enq = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    //队列满返回false
+    bool push(T *data)
+    {
+        cell *c;
+        size_t pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+        for (;;)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            long diff = (long)seq - (long)pos;
+            //槽位空闲，抢占该位置
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&m_enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            //槽位中的数据还没被取走，队列已满
+            else if (diff < 0)
+            {
+                return false;
+            }
+            //被其他生产者抢先
+            else
+            {
+                pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+            }
+        }
+        c->data = data;
+        __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    //队列空返回false
+    bool pop(T *&data)
+    {
+        cell *c;
+        size_t pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+        for (;;)
+        {
+            c = &m_buffer[pos & m_mask];
+            size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&m_dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+            }
+        }
+        data = c->data;
+        //序号推进一圈，槽位交还给生产者
+        __atomic_store_n(&c->seq, pos + m_mask + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    struct cell
+    {
+        size_t seq;
+        T *data;
+    };
+
+    //生产者和消费者的位置各占一个缓存行，避免伪共享
+    char m_pad0[CACHELINE_SIZE];
+    cell *m_buffer;
+    size_t m_mask;
+    char m_pad1[CACHELINE_SIZE - sizeof(cell *) - sizeof(size_t)];
+    size_t m_enqueue_pos;
+    char m_pad2[CACHELINE_SIZE - sizeof(size_t)];
+    size_t m_dequeue_pos;
+    char m_pad3[CACHELINE_SIZE - sizeof(size_t)];
+};
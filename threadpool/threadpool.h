@@ -1,144 +1,779 @@
 #pragma once
-#include <list>
 #include <cstdio>
 #include <exception>
+#include <new>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "../lock/locker.h"
+#include "../log/log.h"
+#include "mpmc_queue.h"
+#include "ws_deque.h"
 
+//工作线程在队列空时先自旋的次数，之后在futex上休眠
+#define WORKER_SPIN_COUNT 256
+
+//弹性线程数的调整周期，毫秒
+#define POOL_ADJUST_MS 50
+//估算的排队时间超过该值时增加线程，毫秒
+#define POOL_GROW_WAIT_MS 2
+//线程数超过CPU核数后，只有工作线程阻塞时间占比超过该百分比才继续增加
+#define POOL_GROW_BLOCKED_PCT 30
+//连续这么多个周期利用率低于一半时减少一个线程
+#define POOL_SHRINK_TICKS 20
+//每处理这么多个任务采样一次阻塞时间，线程CPU时间需要一次系统调用
+#define POOL_SAMPLE_MASK 7
+
+// CoDel：一个间隔内排队时间的最小值超过目标值时进入过载状态，毫秒
+#define CODEL_TARGET_MS 5
+#define CODEL_INTERVAL_MS 100
+
+//请求的优先级：高优先级(如静态文件)总是先处理；低优先级(如需要查询数据库的请求)有并发上限
+enum
+{
+    PRIO_HIGH = 0,
+    PRIO_LOW = 1
+};
+//连续处理这么多个高优先级任务后，优先看一次低优先级队列，避免其饿死
+#define POOL_LOW_EVERY 8
+
+//请求计数
+struct pool_stats
+{
+    long long queued;   //进入队列的请求
+    long long rejected; //队列满，入队时被拒绝的请求
+    long long shed;     //排队过久，出队时被拒绝的请求
+    long long served;   //处理完的请求
+};
+
+// T需要提供process()、reject()，以及记录入队时间的set_enqueue_time()/enqueue_time()
 template <typename T>
 class threadpool
 {
 public:
     // thread_number是线程池中线程的数量
     // max_requests是请求队列中最多允许的、等待处理的请求的数量
-    threadpool(int thread_number = 8, int max_request = 10000);
+    // work_stealing为是否使用工作窃取模式：每个工作线程有自己的队列，空闲时从其他线程窃取
+    // max_thread大于thread_number时线程数在二者之间按排队时间和阻塞时间伸缩，否则固定为thread_number
+    // cpus非空时编号为i的工作线程绑定到cpus[i % cpus.size()]
+    // low_pct为同时处理低优先级任务的线程数占当前线程数的百分比上限，至少为1个线程
+    threadpool(int thread_number = 8, int max_request = 10000, bool work_stealing = false, int max_thread = 0,
+               const std::vector<int> &cpus = std::vector<int>(), int low_pct = 50);
     ~threadpool();
 
-    //向请求队列中插入任务请求
-    bool append(T *request);
+    //向请求队列中插入任务请求，队列满返回false，由调用者拒绝该请求
+    //工作窃取模式下按hint(如连接的sockfd)选择工作线程，同一连接的请求落在同一线程上，缓存更热
+    // prio为PRIO_HIGH或PRIO_LOW，低优先级任务进入单独的共享队列
+    bool append(T *request, int hint = -1, int prio = PRIO_HIGH);
+
+    //当前的工作线程数
+    int thread_number() const { return __atomic_load_n(&m_thread_number, __ATOMIC_RELAXED); }
+    //读取请求计数
+    void get_stats(pool_stats &stats) const;
+
+    //排空：等待已入队的任务全部处理完，最多timeout_ms毫秒，然后通知所有线程退出
+    //在期限内处理完时回收所有线程并返回true；否则仍有线程在处理任务，不回收，返回false，此时不能析构线程池
+    //调用前应先停止入队
+    bool drain(int timeout_ms);
 
 private:
+    //工作窃取模式下每个工作线程的队列
+    //反应堆把任务放入inbox，所属线程把inbox中的任务转入deque，其他线程从deque顶部或inbox窃取
+    struct worker_queue
+    {
+        worker_queue(size_t capacity) : inbox(capacity), deque(capacity), retiring(false) {}
+        mpmc_queue<T> inbox;
+        ws_deque<T> deque;
+        //所属线程在此休眠
+        eventcount parker;
+        //所属线程是否被要求退出
+        bool retiring;
+    };
+
+    //每个编号的统计，各占一个缓存行，只由该编号上的线程写入
+    //按缓存行对齐，C++14的new不保证超过16字节的对齐，数组用posix_memalign分配
+    struct alignas(CACHELINE_SIZE) worker_stat
+    {
+        long long completed; //处理的任务数
+        long long wall_ns;   //采样任务的处理时间
+        long long cpu_ns;    //采样任务消耗的线程CPU时间
+        long long shed;      //因排队过久被拒绝的任务数
+        // CoDel当前间隔的起点和其中的最小排队时间，纳秒
+        long long window_start;
+        long long min_sojourn;
+        int high_streak;     //连续处理的高优先级任务数
+        bool overloaded;     //上一个间隔判定为过载
+        bool running;        //该编号上是否有线程在运行
+    };
+
+    struct worker_arg
+    {
+        threadpool *pool;
+        int index;
+    };
+
     //工作线程运行的函数
     //它不断从工作队列中取出任务并执行之
     static void *worker(void *arg);
-    void run();
+    void run(int index);
+    //取一个任务，没有则返回false；low表示取到的是低优先级任务，处理完要归还并发名额
+    bool take(int index, T *&request, bool &low);
+    bool take_high(int index, T *&request);
+    bool take_low(T *&request);
+    bool steal(int index, T *&request);
+    //唤醒一个休眠的工作线程，没有则返回false
+    bool wake_one(int from);
+    //处理一个任务，按采样间隔记录处理时间和CPU时间
+    void process(int index, T *request);
+    //空闲的工作线程是否应该退出
+    bool should_retire(int index);
+    //按排队时间判断是否丢弃该任务
+    bool codel_shed(worker_stat *stat, long long sojourn, long long now);
+
+    //创建编号为index的工作线程，该编号上已退出的线程先回收
+    bool spawn(int index);
+    //通知所有线程退出，join为true时等待并回收
+    void stop_threads(bool join);
+    //调整线程数的线程
+    static void *adjuster(void *arg);
+    void adjust();
+    //队列中等待的任务数
+    size_t queue_size();
+    //新线程可用的编号，工作窃取模式下必须是当前线程数，没有返回-1
+    int free_index(int n);
 
 private:
     //线程池中的线程数
     int m_thread_number;
+    int m_min_threads;
+    int m_max_threads;
 
     //请求队列中允许的最大请求数
     int m_max_requests;
 
-    //描述线程池的数组，其大小为m_thread_number
-    pthread_t *m_threads;
+    //请求队列，无锁环形队列，容量由max_request决定
+    mpmc_queue<T> m_workqueue;
+
+    //队列空时空闲工作线程在此休眠
+    eventcount m_idle;
+
+    //工作窃取模式，队列按最大线程数分配
+    bool m_work_stealing;
+    worker_queue **m_workers;
+    //没有hint时轮流选择工作线程
+    unsigned m_next_worker;
 
-    //请求队列
-    std::list<T *> m_workqueue;
+    //共享队列模式下待退出的线程数
+    int m_retire;
 
-    //保护请求队列的互斥锁
-    locker m_queuelocker;
+    //低优先级任务的队列，两种模式下都是共享的；正在处理的低优先级任务数及其百分比上限
+    mpmc_queue<T> m_lowqueue;
+    int m_low_running;
+    int m_low_pct;
 
-    //是否有任务需要处理
-    sem m_queuestat;
+    //入队计数，由各反应堆线程修改，单独占一个缓存行
+    char m_pad0[CACHELINE_SIZE];
+    long long m_queued;
+    long long m_rejected;
+    char m_pad1[CACHELINE_SIZE];
+
+    //按编号的统计，大小为m_max_threads
+    worker_stat *m_stats;
+
+    //工作线程绑定的CPU
+    std::vector<int> m_cpus;
+
+    //按编号的线程id，及该编号上是否有尚未回收的线程
+    pthread_t *m_threads;
+    bool *m_joinable;
+    //调整线程数的线程
+    pthread_t m_adjuster;
+    bool m_has_adjuster;
 
     //是否结束线程
     bool m_stop;
 };
 
+static inline long long pool_clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 template <typename T>
-threadpool<T>::threadpool(int thread_number, int max_request) : m_thread_number(thread_number), m_max_requests(max_request), m_stop(false), m_threads(NULL)
+threadpool<T>::threadpool(int thread_number, int max_request, bool work_stealing, int max_thread, const std::vector<int> &cpus, int low_pct) : m_thread_number(0), m_min_threads(thread_number), m_max_threads(max_thread > thread_number ? max_thread : thread_number), m_max_requests(max_request), m_workqueue(work_stealing ? 1 : max_request), m_work_stealing(work_stealing), m_workers(NULL), m_next_worker(0), m_retire(0), m_lowqueue(max_request), m_low_running(0), m_low_pct(low_pct), m_queued(0), m_rejected(0), m_stats(NULL), m_cpus(cpus), m_threads(NULL), m_joinable(NULL), m_has_adjuster(false), m_stop(false)
 {
     if (thread_number <= 0 || max_request <= 0)
         throw std::exception();
 
-    //线程id初始化
-    m_threads = new pthread_t[thread_number];
-    if (!m_threads)
+    //工作窃取模式下请求队列的容量均分给各编号
+    if (m_work_stealing)
+    {
+        m_workers = new worker_queue *[m_max_threads];
+        for (int i = 0; i < m_max_threads; i++)
+            m_workers[i] = new worker_queue((max_request + m_max_threads - 1) / m_max_threads);
+    }
+
+    void *stats;
+    if (posix_memalign(&stats, CACHELINE_SIZE, sizeof(worker_stat) * m_max_threads) != 0)
         throw std::exception();
+    m_stats = (worker_stat *)stats;
+    for (int i = 0; i < m_max_threads; i++)
+        new (&m_stats[i]) worker_stat();
+    m_threads = new pthread_t[m_max_threads];
+    m_joinable = new bool[m_max_threads];
+    memset(m_joinable, 0, sizeof(bool) * m_max_threads);
 
     for (int i = 0; i < thread_number; i++)
     {
         //循环创建线程，并将工作线程按要求进行运行
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0)
-        {
-            delete[] m_threads;
+        if (!spawn(i))
             throw std::exception();
-        }
+    }
 
-        //将线程进行分离后，不用单独对工作线程进行回收
-        if (pthread_detach(m_threads[i]))
-        {
-            delete[] m_threads;
+    //线程数可以伸缩时，另起一个线程定期调整
+    if (m_max_threads > m_min_threads)
+    {
+        if (pthread_create(&m_adjuster, NULL, adjuster, this) != 0)
             throw std::exception();
-        }
+        m_has_adjuster = true;
     }
 }
 
 template <typename T>
 threadpool<T>::~threadpool()
 {
+    //等待所有线程退出后再释放它们使用的队列和统计
+    stop_threads(true);
+
+    if (m_workers)
+    {
+        for (int i = 0; i < m_max_threads; i++)
+            delete m_workers[i];
+        delete[] m_workers;
+    }
+    //worker_stat可平凡析构，直接释放
+    free(m_stats);
     delete[] m_threads;
-    m_stop = true;
+    delete[] m_joinable;
 }
 
 template <typename T>
-bool threadpool<T>::append(T *request)
+void threadpool<T>::stop_threads(bool join)
 {
-    m_queuelocker.lock();
+    __atomic_store_n(&m_stop, true, __ATOMIC_SEQ_CST);
 
-    //根据硬件，预先设置请求队列的最大值
-    if (m_workqueue.size() > m_max_requests)
+    //先回收调整线程，之后不会再有新的工作线程被创建
+    if (join && m_has_adjuster)
     {
-        m_queuelocker.unlock();
-        return false;
+        pthread_join(m_adjuster, NULL);
+        m_has_adjuster = false;
+    }
+
+    //唤醒所有休眠的工作线程，它们看到m_stop后退出
+    if (m_work_stealing)
+    {
+        for (int i = 0; i < m_max_threads; i++)
+            m_workers[i]->parker.notify_all();
+    }
+    else
+    {
+        m_idle.notify_all();
+    }
+
+    if (!join)
+        return;
+    for (int i = 0; i < m_max_threads; i++)
+    {
+        if (m_joinable[i])
+        {
+            pthread_join(m_threads[i], NULL);
+            m_joinable[i] = false;
+        }
+    }
+}
+
+template <typename T>
+bool threadpool<T>::drain(int timeout_ms)
+{
+    long long deadline = pool_clock_ns(CLOCK_MONOTONIC) + (long long)timeout_ms * 1000000LL;
+
+    //入队的任务都已处理或丢弃，且没有线程正在处理
+    pool_stats stats;
+    get_stats(stats);
+    while (stats.queued > stats.served + stats.shed && pool_clock_ns(CLOCK_MONOTONIC) < deadline)
+    {
+        usleep(1000);
+        get_stats(stats);
+    }
+
+    bool drained = stats.queued <= stats.served + stats.shed;
+    if (!drained)
+    {
+        LOG_WARN("threadpool drain timeout, %lld requests unfinished", stats.queued - stats.served - stats.shed);
+        Log::get_instance()->flush();
+    }
+    stop_threads(drained);
+    return drained;
+}
+
+template <typename T>
+bool threadpool<T>::spawn(int index)
+{
+    //该编号上被缩减的线程已经归还编号，回收它
+    if (m_joinable[index])
+    {
+        pthread_join(m_threads[index], NULL);
+        m_joinable[index] = false;
     }
 
-    //添加任务
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
+    worker_arg *arg = new worker_arg;
+    arg->pool = this;
+    arg->index = index;
+    if (m_work_stealing)
+        m_workers[index]->retiring = false;
+    __atomic_store_n(&m_stats[index].running, true, __ATOMIC_RELEASE);
+
+    //线程创建时即绑定CPU，栈等首次访问的内存分配在该CPU所在的NUMA结点
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (!m_cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[index % m_cpus.size()], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
 
-    //信号量提醒有任务要处理
-    m_queuestat.post();
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attr, worker, arg);
+    pthread_attr_destroy(&attr);
+    if (ret != 0)
+    {
+        __atomic_store_n(&m_stats[index].running, false, __ATOMIC_RELEASE);
+        delete arg;
+        return false;
+    }
+    m_threads[index] = tid;
+    m_joinable[index] = true;
+    __atomic_fetch_add(&m_thread_number, 1, __ATOMIC_RELEASE);
     return true;
 }
 
-//参数传入的是threadpool对象
+template <typename T>
+bool threadpool<T>::wake_one(int from)
+{
+    if (!m_work_stealing)
+        return m_idle.notify_one();
+
+    for (int i = 0; i < m_max_threads; i++)
+    {
+        if (m_workers[(from + i) % m_max_threads]->parker.notify_one())
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool threadpool<T>::append(T *request, int hint, int prio)
+{
+    request->set_enqueue_time(pool_clock_ns(CLOCK_MONOTONIC));
+
+    if (prio == PRIO_LOW)
+    {
+        if (!m_lowqueue.push(request))
+        {
+            __atomic_fetch_add(&m_rejected, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        __atomic_fetch_add(&m_queued, 1, __ATOMIC_RELAXED);
+        wake_one(hint >= 0 ? hint : 0);
+        return true;
+    }
+
+    if (!m_work_stealing)
+    {
+        //请求队列已满
+        if (!m_workqueue.push(request))
+        {
+            __atomic_fetch_add(&m_rejected, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+        __atomic_fetch_add(&m_queued, 1, __ATOMIC_RELAXED);
+
+        //只有存在休眠的工作线程时才进入内核唤醒
+        m_idle.notify_one();
+        return true;
+    }
+
+    //只分给编号小于当前线程数的工作线程
+    int n = thread_number();
+    int target = hint >= 0 ? hint % n : (int)(__atomic_fetch_add(&m_next_worker, 1, __ATOMIC_RELAXED) % n);
+
+    //目标线程的队列满了，依次放入后面的线程
+    for (int i = 0; i < m_max_threads; i++)
+    {
+        int w = (target + i) % m_max_threads;
+        if (!m_workers[w]->inbox.push(request))
+            continue;
+        __atomic_fetch_add(&m_queued, 1, __ATOMIC_RELAXED);
+
+        //目标线程在休眠则唤醒它；它正忙时唤醒一个休眠的线程来窃取
+        wake_one(w);
+        return true;
+    }
+    __atomic_fetch_add(&m_rejected, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+template <typename T>
+void threadpool<T>::get_stats(pool_stats &stats) const
+{
+    stats.queued = __atomic_load_n(&m_queued, __ATOMIC_RELAXED);
+    stats.rejected = __atomic_load_n(&m_rejected, __ATOMIC_RELAXED);
+    stats.shed = 0;
+    stats.served = 0;
+    for (int i = 0; i < m_max_threads; i++)
+    {
+        stats.shed += __atomic_load_n(&m_stats[i].shed, __ATOMIC_RELAXED);
+        stats.served += __atomic_load_n(&m_stats[i].completed, __ATOMIC_RELAXED);
+    }
+}
+
+//参数传入的是threadpool对象和线程编号
 template <typename T>
 void *threadpool<T>::worker(void *arg)
 {
     //将参数强转为线程池类，调用成员方法
-    threadpool *pool = (threadpool *)arg;
-    pool->run();
+    worker_arg *wa = (worker_arg *)arg;
+    threadpool *pool = wa->pool;
+    int index = wa->index;
+    delete wa;
+    pool->run(index);
     return pool;
 }
 
 template <typename T>
-void threadpool<T>::run()
+bool threadpool<T>::take(int index, T *&request, bool &low)
 {
-    //线程不终止
-    while (!m_stop)
+    worker_stat *stat = &m_stats[index];
+    low = false;
+
+    //高优先级任务优先，但每处理POOL_LOW_EVERY个之后先看一次低优先级队列
+    if (stat->high_streak >= POOL_LOW_EVERY && take_low(request))
     {
-        //信号量等待
-        m_queuestat.wait();
+        low = true;
+        stat->high_streak = 0;
+        return true;
+    }
+    if (take_high(index, request))
+    {
+        ++stat->high_streak;
+        return true;
+    }
+    if (take_low(request))
+    {
+        low = true;
+        stat->high_streak = 0;
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool threadpool<T>::take_low(T *&request)
+{
+    //队列为空时不去竞争并发名额
+    if (m_lowqueue.size() == 0)
+        return false;
+
+    //同时处理低优先级任务的线程数不超过上限，其余线程留给高优先级任务
+    int limit = thread_number() * m_low_pct / 100;
+    if (limit < 1)
+        limit = 1;
+    int running = __atomic_load_n(&m_low_running, __ATOMIC_RELAXED);
+    do
+    {
+        if (running >= limit)
+            return false;
+    } while (!__atomic_compare_exchange_n(&m_low_running, &running, running + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (m_lowqueue.pop(request))
+        return true;
+    __atomic_fetch_sub(&m_low_running, 1, __ATOMIC_RELEASE);
+    return false;
+}
+
+template <typename T>
+bool threadpool<T>::take_high(int index, T *&request)
+{
+    if (!m_work_stealing)
+        return m_workqueue.pop(request);
+
+    worker_queue *self = m_workers[index];
+    if (self->deque.pop(request))
+        return true;
+
+    //自己的deque空了，从inbox取一个来处理，其余转入deque供其他线程窃取
+    if (self->inbox.pop(request))
+    {
+        T *more;
+        while (!self->deque.full() && self->inbox.pop(more))
+            self->deque.push(more);
+        return true;
+    }
+    return steal(index, request);
+}
+
+template <typename T>
+bool threadpool<T>::steal(int index, T *&request)
+{
+    //先窃取其他线程deque中最早的任务，再从还没被转移的inbox中取
+    //已退出的编号上可能残留任务，同样要检查
+    for (int i = 1; i < m_max_threads; i++)
+    {
+        if (m_workers[(index + i) % m_max_threads]->deque.steal(request))
+            return true;
+    }
+    for (int i = 1; i < m_max_threads; i++)
+    {
+        if (m_workers[(index + i) % m_max_threads]->inbox.pop(request))
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+bool threadpool<T>::codel_shed(worker_stat *stat, long long sojourn, long long now)
+{
+    if (sojourn < stat->min_sojourn)
+        stat->min_sojourn = sojourn;
+
+    //一个间隔内排队时间始终高于目标值，说明队列持续积压而不是短暂的突发
+    if (now - stat->window_start >= CODEL_INTERVAL_MS * 1000000LL)
+    {
+        stat->overloaded = stat->min_sojourn > CODEL_TARGET_MS * 1000000LL;
+        stat->window_start = now;
+        stat->min_sojourn = sojourn;
+    }
+
+    //过载时排队超过两倍目标值的请求直接拒绝，让队列尽快排空，而不是让所有请求都等到超时
+    return stat->overloaded && sojourn > 2 * CODEL_TARGET_MS * 1000000LL;
+}
+
+template <typename T>
+void threadpool<T>::process(int index, T *request)
+{
+    worker_stat *stat = &m_stats[index];
+
+    long long now = pool_clock_ns(CLOCK_MONOTONIC);
+    if (codel_shed(stat, now - request->enqueue_time(), now))
+    {
+        request->reject();
+        __atomic_store_n(&stat->shed, stat->shed + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    long long completed = stat->completed;
+
+    //阻塞时间 = 处理时间 - 线程CPU时间，主要是等待数据库的时间
+    if ((completed & POOL_SAMPLE_MASK) == 0)
+    {
+        long long wall = pool_clock_ns(CLOCK_MONOTONIC);
+        long long cpu = pool_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        request->process();
+        __atomic_store_n(&stat->wall_ns, stat->wall_ns + pool_clock_ns(CLOCK_MONOTONIC) - wall, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->cpu_ns, stat->cpu_ns + pool_clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        request->process();
+    }
+    __atomic_store_n(&stat->completed, completed + 1, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+bool threadpool<T>::should_retire(int index)
+{
+    if (m_work_stealing)
+        return __atomic_load_n(&m_workers[index]->retiring, __ATOMIC_ACQUIRE);
 
-        //被唤醒后先加互斥锁
-        m_queuelocker.lock();
-        if (m_workqueue.empty())
+    int retire = __atomic_load_n(&m_retire, __ATOMIC_ACQUIRE);
+    while (retire > 0)
+    {
+        if (__atomic_compare_exchange_n(&m_retire, &retire, retire - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return true;
+    }
+    return false;
+}
+
+template <typename T>
+void threadpool<T>::run(int index)
+{
+    eventcount &idle = m_work_stealing ? m_workers[index]->parker : m_idle;
+
+    //线程不终止，直到线程池排空或析构
+    while (!__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE))
+    {
+        //从请求队列中取出一个任务，队列空时短暂自旋
+        T *request = NULL;
+        bool low = false;
+        bool got = take(index, request, low);
+        for (int i = 0; !got && i < WORKER_SPIN_COUNT; ++i)
         {
-            m_queuelocker.unlock();
+            cpu_relax();
+            got = take(index, request, low);
+        }
+
+        //空闲时才响应缩减，工作窃取模式下自己的队列此时已经取空
+        if (!got && should_retire(index))
+            break;
+
+        //队列被取空，本间隔不算过载
+        if (!got)
+            m_stats[index].min_sojourn = 0;
+
+        //仍然没有任务，登记为等待者后再检查一次，避免漏掉休眠前入队的任务
+        if (!got)
+        {
+            unsigned key = idle.prepare_wait();
+            got = take(index, request, low);
+            if (got || __atomic_load_n(&m_stop, __ATOMIC_SEQ_CST))
+                idle.cancel_wait();
+            else
+                idle.commit_wait(key);
+        }
+
+        if (!got)
             continue;
+
+        if (request)
+            process(index, request);
+
+        //归还低优先级任务的并发名额
+        if (low)
+            __atomic_fetch_sub(&m_low_running, 1, __ATOMIC_RELEASE);
+    }
+
+    //归还编号
+    __atomic_store_n(&m_stats[index].running, false, __ATOMIC_RELEASE);
+}
+
+template <typename T>
+size_t threadpool<T>::queue_size()
+{
+    if (!m_work_stealing)
+        return m_workqueue.size() + m_lowqueue.size();
+
+    size_t size = m_lowqueue.size();
+    for (int i = 0; i < m_max_threads; i++)
+        size += m_workers[i]->inbox.size() + m_workers[i]->deque.size();
+    return size;
+}
+
+template <typename T>
+int threadpool<T>::free_index(int n)
+{
+    //工作窃取模式下只分配任务给编号小于线程数的线程，该编号上一个线程还没退出时等待
+    if (m_work_stealing)
+        return __atomic_load_n(&m_stats[n].running, __ATOMIC_ACQUIRE) ? -1 : n;
+
+    //共享队列模式下退出的可能是任意线程
+    for (int i = 0; i < m_max_threads; i++)
+    {
+        if (!__atomic_load_n(&m_stats[i].running, __ATOMIC_ACQUIRE))
+            return i;
+    }
+    return -1;
+}
+
+template <typename T>
+void *threadpool<T>::adjuster(void *arg)
+{
+    threadpool *pool = (threadpool *)arg;
+    pool->adjust();
+    return pool;
+}
+
+template <typename T>
+void threadpool<T>::adjust()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    long long last_completed = 0, last_wall = 0, last_cpu = 0;
+    int idle_ticks = 0;
+
+    while (!__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE))
+    {
+        usleep(POOL_ADJUST_MS * 1000);
+
+        long long completed = 0, wall = 0, cpu = 0;
+        for (int i = 0; i < m_max_threads; i++)
+        {
+            completed += __atomic_load_n(&m_stats[i].completed, __ATOMIC_RELAXED);
+            wall += __atomic_load_n(&m_stats[i].wall_ns, __ATOMIC_RELAXED);
+            cpu += __atomic_load_n(&m_stats[i].cpu_ns, __ATOMIC_RELAXED);
         }
+        long long done = completed - last_completed;
+        long long busy = (wall - last_wall) * (POOL_SAMPLE_MASK + 1);
+        long long blocked = (wall - last_wall) - (cpu - last_cpu);
+        int blocked_pct = wall > last_wall ? (int)(blocked * 100 / (wall - last_wall)) : 0;
+        last_completed = completed;
+        last_wall = wall;
+        last_cpu = cpu;
 
-        //从请求队列中取出第一个任务
-        //将任务从请求队列删除
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
+        //由Little定律估算排队时间：队列长度 / 吞吐量
+        //本周期没有任务完成而队列非空，说明所有线程都被占住，排队时间至少一个周期
+        size_t queued = queue_size();
+        long long wait_us = 0;
+        if (queued > 0)
+            wait_us = done > 0 ? (long long)queued * POOL_ADJUST_MS * 1000 / done : POOL_ADJUST_MS * 1000;
 
-        m_queuelocker.unlock();
-        if (!request)
+        int n = thread_number();
+        //采样估算的利用率，百分比
+        int util_pct = (int)(busy * 100 / ((long long)n * POOL_ADJUST_MS * 1000000));
+
+        //排队过长时增加线程；超过CPU核数后，只有线程大多在阻塞等待(如数据库)时增加才有意义
+        if (wait_us >= POOL_GROW_WAIT_MS * 1000 && n < m_max_threads && (n < cores || blocked_pct >= POOL_GROW_BLOCKED_PCT))
+        {
+            idle_ticks = 0;
+            //被缩减的线程还没退出时等下一个周期
+            int index = free_index(n);
+            if (index >= 0 && spawn(index))
+            {
+                LOG_INFO("threadpool grow %d -> %d (queued %d, wait %lldus, blocked %d%%)", n, n + 1, (int)queued, wait_us, blocked_pct);
+                Log::get_instance()->flush();
+            }
             continue;
+        }
 
-        request->process();
+        //队列为空且利用率持续偏低时减少线程
+        if (queued == 0 && util_pct < 50 && n > m_min_threads)
+        {
+            if (++idle_ticks < POOL_SHRINK_TICKS)
+                continue;
+            idle_ticks = 0;
+
+            //先从线程数中去掉，新任务不再分给它，再通知它在空闲时退出
+            __atomic_fetch_sub(&m_thread_number, 1, __ATOMIC_RELEASE);
+            if (m_work_stealing)
+            {
+                __atomic_store_n(&m_workers[n - 1]->retiring, true, __ATOMIC_RELEASE);
+                m_workers[n - 1]->parker.notify_one();
+            }
+            else
+            {
+                __atomic_fetch_add(&m_retire, 1, __ATOMIC_RELEASE);
+                m_idle.notify_one();
+            }
+            LOG_INFO("threadpool shrink %d -> %d (util %d%%)", n, n - 1, util_pct);
+            Log::get_instance()->flush();
+            continue;
+        }
+        idle_ticks = 0;
     }
-}
\ No newline at end of file
+}
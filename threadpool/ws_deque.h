@@ -0,0 +1,102 @@
+#pragma once
+#include <stddef.h>
+
+#ifndef CACHELINE_SIZE
+#define CACHELINE_SIZE 64
+#endif
+
+// Chase-Lev工作窃取双端队列(固定容量，按Lê等人的C11内存序实现)
+//所属线程在底部push/pop(后进先出，缓存更热)，其他线程从顶部steal(先进先出)
+//容量向上取整为2的幂，满时push返回false，不扩容
+template <typename T>
+class ws_deque
+{
+public:
+    ws_deque(size_t capacity) : m_top(0), m_bottom(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_buffer = new T *[size];
+        m_mask = size - 1;
+    }
+    ~ws_deque()
+    {
+        delete[] m_buffer;
+    }
+
+    //队列中的元素个数，可由任意线程调用，只是近似值
+    size_t size() const
+    {
+        long t = __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+        return b > t ? b - t : 0;
+    }
+
+    //以下三个函数只能由所属线程调用
+    bool full() const
+    {
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+        long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        return b - t > (long)m_mask;
+    }
+
+    bool push(T *data)
+    {
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+        long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        if (b - t > (long)m_mask)
+            return false;
+        __atomic_store_n(&m_buffer[b & m_mask], data, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    bool pop(T *&data)
+    {
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - 1;
+        __atomic_store_n(&m_bottom, b, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long t = __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+
+        //队列为空
+        if (t > b)
+        {
+            __atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        data = __atomic_load_n(&m_buffer[b & m_mask], __ATOMIC_RELAXED);
+        if (t == b)
+        {
+            //只剩最后一个，与窃取者竞争
+            bool won = __atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&m_bottom, b + 1, __ATOMIC_RELAXED);
+            return won;
+        }
+        return true;
+    }
+
+    //可由任意线程调用，队列空或与其他线程竞争失败返回false
+    bool steal(T *&data)
+    {
+        long t = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long b = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+        if (t >= b)
+            return false;
+
+        data = __atomic_load_n(&m_buffer[t & m_mask], __ATOMIC_RELAXED);
+        return __atomic_compare_exchange_n(&m_top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+
+private:
+    //顶部由窃取者竞争修改，底部只由所属线程修改，各占一个缓存行
+    long m_top;
+    char m_pad0[CACHELINE_SIZE - sizeof(long)];
+    long m_bottom;
+    char m_pad1[CACHELINE_SIZE - sizeof(long)];
+    T **m_buffer;
+    size_t m_mask;
+};
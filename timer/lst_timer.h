@@ -15,210 +15,282 @@
 #define BUFFER_SIZE 64
 
 class util_timer;
+class reactor;
+
+//定时器类，侵入式地嵌入client_data，连接建立时无需再分配定时器
+//未挂入时间轮时prev和next为NULL
+class util_timer
+{
+public:
+    util_timer() : expire(0), cb_func(NULL), user_data(NULL), prev(NULL), next(NULL) {}
+
+    //是否挂在时间轮上
+    bool pending() const { return next != NULL; }
+
+public:
+    long long expire;                     //超时时间，单调时钟毫秒
+    void (*cb_func)(struct client_data *); //回调函数
+    struct client_data *user_data;        //连接资源
+    util_timer *prev;
+    util_timer *next;
+};
 
 struct client_data
 {
     sockaddr_in address; //客户端socket地址
     int sockfd;
     char buf[BUFFER_SIZE];
-    util_timer *timer;
+    util_timer timer; //连接的定时器
+    reactor *owner;   //连接所属的反应堆
+    int slot;         //连接在所属反应堆连接表中的下标
 };
 
-//定时器类
-class util_timer
+//单调时钟的当前毫秒数，不受系统时间调整影响
+inline long long timer_now_ms()
 {
-public:
-    util_timer() : prev(NULL), next(NULL) {}
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-public:
-    time_t expire;                  //超时时间
-    void (*cb_func)(client_data *); //回调函数
-    client_data *user_data;         //连接资源
-    util_timer *prev;
-    util_timer *next;
-};
+//分层时间轮
+//共TW_LEVELS层，每层TW_SLOTS个槽，第n层一个槽跨越TW_SLOTS^n个刻度
+//定时器按到期刻度与当前刻度之差放入对应层，高层的槽在低层转满一圈时向下层重新分配
+//添加、调整、删除都是O(1)；tick把到期的槽整体摘下后再逐个回调
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+#define TW_LEVELS 4
 
-class sort_timer_lst
+class time_wheel
 {
 public:
-    sort_timer_lst() : head(NULL), tail(NULL) {}
-    ~sort_timer_lst()
+    // resolution_ms为一个刻度的毫秒数
+    time_wheel(int resolution_ms = 1000) : m_resolution(resolution_ms), m_count(0)
     {
-        util_timer *tmp = head;
-        while (tmp)
+        m_current = timer_now_ms() / m_resolution;
+        for (int l = 0; l < TW_LEVELS; ++l)
         {
-            head = tmp->next;
-            delete tmp;
-            tmp = head;
+            for (int i = 0; i < TW_SLOTS; ++i)
+            {
+                //每个槽是一个带哨兵的双向循环链表
+                m_slots[l][i].prev = &m_slots[l][i];
+                m_slots[l][i].next = &m_slots[l][i];
+            }
         }
     }
 
-    //添加定时器，内部调用私有成员add_timer
+    //添加定时器，expire须已设置
     void add_timer(util_timer *timer)
     {
         if (!timer)
         {
             return;
         }
-        if (!head)
+        //已在时间轮上则先摘下
+        if (timer->pending())
         {
-            head = tail = timer;
-            return;
+            unlink(timer);
         }
-        if (timer->expire < head->expire)
+        insert(timer);
+        ++m_count;
+    }
+
+    //调整定时器，expire更新后重新挂到对应的槽
+    void adjust_timer(util_timer *timer)
+    {
+        if (!timer || !timer->pending())
         {
-            timer->next = head;
-            head->prev = timer;
-            head = timer;
             return;
         }
-        add_timer(timer, head);
+        unlink(timer);
+        insert(timer);
     }
 
-    //调整定时器，任务发生变化时，调整定时器在链表中的位置
-    void adjust_timer(util_timer *timer)
+    //删除定时器，结点归还给所属的client_data，不释放内存
+    void del_timer(util_timer *timer)
     {
-        if (!timer)
+        if (!timer || !timer->pending())
         {
             return;
         }
+        unlink(timer);
+        --m_count;
+    }
 
-        util_timer *tmp = timer->next;
+    //定时任务处理函数，推进到当前时间，回调所有到期的定时器
+    void tick()
+    {
+        long long target = timer_now_ms() / m_resolution;
 
-        //被调整的定时器在链表尾部
-        //定时器超时值仍然小于下一个定时器超时值，不调整
-        if (!tmp || (timer->expire < tmp->expire))
+        //时间轮为空时直接跳到当前刻度
+        if (m_count == 0)
         {
+            m_current = target + 1;
             return;
         }
 
-        //被调整定时器是链表头结点，将定时器取出，重新插入
-        if (timer == head)
+        LOG_INFO("%s", "timer tick");
+        Log::get_instance()->flush();
+
+        //到期的定时器先汇总到expired链表，推进结束后统一回调
+        util_timer expired;
+        expired.prev = expired.next = &expired;
+
+        while (m_current <= target)
         {
-            head = head->next;
-            head->prev = NULL;
-            timer->next = NULL;
-            add_timer(timer, head);
+            int index = m_current & TW_MASK;
+
+            //第0层转满一圈，逐层把上一层当前槽的定时器重新分配下来
+            if (index == 0)
+            {
+                for (int l = 1; l < TW_LEVELS; ++l)
+                {
+                    int upper = (m_current >> (l * TW_BITS)) & TW_MASK;
+                    cascade(l, upper);
+                    if (upper != 0)
+                        break;
+                }
+            }
+
+            splice(&m_slots[0][index], &expired);
+            ++m_current;
         }
-        //被调整定时器在内部，将定时器取出，重新插入
-        else
+
+        while (expired.next != &expired)
         {
-            timer->prev->next = timer->next;
-            timer->next->prev = timer->prev;
-            add_timer(timer, timer->next);
+            util_timer *tmp = expired.next;
+            unlink(tmp);
+            --m_count;
+
+            //当前定时器到期，则调用回调函数，执行定时事件
+            tmp->cb_func(tmp->user_data);
         }
     }
 
-    //删除定时器
-    void del_timer(util_timer *timer)
+    //最近一次需要tick的时间，单调时钟毫秒；时间轮为空返回-1
+    //取第0层最近的到期刻度与高层最近的向下分配刻度中较早的一个
+    //高层的槽返回其向下分配的时间，届时tick后再重新计算，因此可能早于真正的到期时间，不会晚于
+    long long next_expiry()
     {
-        if (!timer)
+        if (m_count == 0)
         {
-            return;
+            return -1;
         }
 
-        //链表中只有一个定时器，需要删除该定时器
-        if ((timer == head) && (timer == tail))
+        //第0层的定时器都在当前刻度之后一圈内，第一个非空槽就是该层最近的到期刻度
+        long long next = -1;
+        for (int i = 0; i < TW_SLOTS; ++i)
         {
-            delete timer;
-            head = NULL;
-            tail = NULL;
-            return;
-        }
-
-        //被删除的定时器为头结点
-        if (timer == head)
-        {
-            head = head->next;
-            head->prev = NULL;
-            delete timer;
-            return;
+            long long t = m_current + i;
+            if (m_slots[0][t & TW_MASK].next != &m_slots[0][t & TW_MASK])
+            {
+                next = t;
+                break;
+            }
         }
 
-        //被删除的定时器为尾结点
-        if (timer == tail)
+        //第level层的槽在低层转满一圈时向下分配，找各层第一个非空槽对应的分配刻度
+        //高层的定时器可能早于第0层的定时器到期，不能只看第0层
+        for (int l = 1; l < TW_LEVELS; ++l)
         {
-            tail = tail->prev;
-            tail->next = NULL;
-            delete timer;
-            return;
+            long long base = m_current >> (l * TW_BITS);
+            for (int i = 0; i <= TW_SLOTS; ++i)
+            {
+                long long t = (base + i) << (l * TW_BITS);
+                int index = (base + i) & TW_MASK;
+                if (t < m_current || m_slots[l][index].next == &m_slots[l][index])
+                {
+                    continue;
+                }
+                if (next < 0 || t < next)
+                {
+                    next = t;
+                }
+                break;
+            }
         }
+        return next * m_resolution;
+    }
 
-        //被删除的定时器在链表内部，常规链表结点删除
+private:
+    void unlink(util_timer *timer)
+    {
         timer->prev->next = timer->next;
         timer->next->prev = timer->prev;
-        delete timer;
+        timer->prev = NULL;
+        timer->next = NULL;
     }
 
-    //定时任务处理函数
-    void tick()
+    void link(util_timer *head, util_timer *timer)
     {
-        if (!head)
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    //把src链表整体接到dst链表尾部
+    void splice(util_timer *src, util_timer *dst)
+    {
+        if (src->next == src)
         {
             return;
         }
+        util_timer *first = src->next;
+        util_timer *last = src->prev;
+        first->prev = dst->prev;
+        dst->prev->next = first;
+        last->next = dst;
+        dst->prev = last;
+        src->prev = src->next = src;
+    }
 
-        LOG_INFO("%s", "timer tick");
-        Log::get_instance()->flush();
-
-        //获取当前时间
-        time_t cur = time(NULL);
-
-        util_timer *tmp = head;
-        //遍历定时器链表
-        while (tmp)
+    //把第level层index槽中的定时器重新放入时间轮
+    void cascade(int level, int index)
+    {
+        util_timer list;
+        list.prev = list.next = &list;
+        splice(&m_slots[level][index], &list);
+        while (list.next != &list)
         {
-            //链表容器为升序排列
-            //当前时间小于定时器的超时时间，后面的定时器也没有到期
-            if (cur < tmp->expire)
-            {
-                break;
-            }
-
-            //当前定时器到期，则调用回调函数，执行定时事件
-            tmp->cb_func(tmp->user_data);
-
-            //将处理后的定时器从链表容器中删除，并重置头结点
-            head = tmp->next;
-            if (head)
-            {
-                head->prev = NULL;
-            }
-            delete tmp;
-            tmp = head;
+            util_timer *tmp = list.next;
+            unlink(tmp);
+            insert(tmp);
         }
     }
 
-private:
-    void add_timer(util_timer *timer, util_timer *lst_head)
+    //根据到期刻度选择层和槽
+    void insert(util_timer *timer)
     {
-        util_timer *prev = lst_head;
-        util_timer *tmp = prev->next;
-        while (tmp)
+        //向上取整，保证不会提前到期
+        long long expires = (timer->expire + m_resolution - 1) / m_resolution;
+        long long delta = expires - m_current;
+
+        //已经到期的放到下一个要处理的槽
+        if (delta < 0)
         {
-            if (timer->expire < tmp->expire)
-            {
-                prev->next = timer;
-                timer->next = tmp;
-                tmp->prev = timer;
-                timer->prev = prev;
-                break;
-            }
-            prev = tmp;
-            tmp = tmp->next;
+            expires = m_current;
+            delta = 0;
         }
-        if (!tmp)
+
+        int level = 0;
+        while (level < TW_LEVELS - 1 && delta >= (1LL << ((level + 1) * TW_BITS)))
         {
-            prev->next = timer;
-            timer->prev = prev;
-            timer->next = NULL;
-            tail = timer;
+            ++level;
         }
+        //超出时间轮范围的放到最高层最远的槽，转到时会再次分配
+        if (delta >= (1LL << (TW_LEVELS * TW_BITS)))
+        {
+            expires = m_current + (1LL << (TW_LEVELS * TW_BITS)) - 1;
+        }
+        int index = (expires >> (level * TW_BITS)) & TW_MASK;
+        link(&m_slots[level][index], timer);
     }
 
 private:
-    util_timer *head;
-    util_timer *tail;
+    int m_resolution;      //刻度，毫秒
+    long long m_current;   //下一个要处理的刻度
+    int m_count;           //时间轮上的定时器个数
+    util_timer m_slots[TW_LEVELS][TW_SLOTS];
 };
-
-/**********************************TODO 时间堆****************************************/